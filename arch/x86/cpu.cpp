@@ -31,8 +31,9 @@ bool infos::arch::x86::cpu_init()
 
 /**
  * Constructs a new X86CPU object.
+ * @param id The logical index of the CPU.
  */
-X86CPU::X86CPU()
+X86CPU::X86CPU(unsigned int id) : CPU(id)
 {
 
 }
@@ -30,6 +30,13 @@ using namespace infos::util;
 
 extern "C" infos::kernel::Thread *current_thread;
 
+// Page fault error code bits.
+#define PF_PRESENT	(1 << 0)
+#define PF_WRITE	(1 << 1)
+
+// The interrupt flag, in RFLAGS.
+#define RFLAGS_IF	(1 << 9)
+
 /**
  * Page fault handler
  * @param irq The IRQ object associated with this exception.
@@ -49,7 +56,22 @@ static void handle_page_fault(const IRQ *irq, void *priv)
 		arch_abort();
 	}
 
-	// If there is a current thread, abort it.
+	X86Context *ctx = (X86Context *)current_thread->context().native_context;
+
+	// A fault on a page in the user half of the address space that is not present may
+	// just be the first touch of a page that is populated on demand.  Populating it can
+	// read from a file, so interrupts are turned back on if the faulting code had them on.
+	if (!(ctx->extra & PF_PRESENT) && fault_address < USER_VMEM_END) {
+		bool enable_interrupts = !!(ctx->rflags & RFLAGS_IF);
+
+		if (enable_interrupts) sys.arch().enable_interrupts();
+		bool resolved = current_thread->owner().vma().handle_fault(fault_address, !!(ctx->extra & PF_WRITE));
+		if (enable_interrupts) sys.arch().disable_interrupts();
+
+		if (resolved) return;
+	}
+
+	// Otherwise, abort the thread's process.
 	syslog.messagef(LogLevel::WARNING, "*** PAGE FAULT @ vaddr=%p rip=%p proc=%s", fault_address, current_thread->context().native_context->rip, current_thread->owner().name().c_str());
 
 	// TODO: support passing page-faults into threads.
@@ -59,6 +81,32 @@ static void handle_page_fault(const IRQ *irq, void *priv)
 // Ugly hack
 uint64_t *__template_pml4;
 
+// Flags of the kernel's page table entries.  Kernel mappings are the same in every address
+// space, so they are global, and survive address space switches.
+#define KPTE_TABLE	0x003
+#define KPTE_LEAF	0x183
+
+#define GB_PAGE_SIZE	(1ull << 30)
+
+/**
+ * Maps 1G of physical memory at an entry of a PDP, with a 1G page if they are supported,
+ * or otherwise with a PD of 2M pages, which is taken from the given pool of pages.
+ */
+static void map_gb(uint64_t *pdp, unsigned int pdp_idx, phys_addr_t pa, bool use_gb_pages, const PageDescriptor *& pd_pool)
+{
+	if (use_gb_pages) {
+		pdp[pdp_idx] = pa | KPTE_LEAF;
+		return;
+	}
+
+	uint64_t *pd = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(pd_pool++);
+	for (unsigned int i = 0; i < 0x200; i++) {
+		pd[i] = (pa + ((phys_addr_t)i << 21)) | KPTE_LEAF;
+	}
+
+	pdp[pdp_idx] = (kva_to_pa((virt_addr_t)pd) & ~0xfff) | KPTE_TABLE;
+}
+
 /**
  * Usurps the initial page tables, and introduces new ones for the
  * higher mapping.
@@ -67,82 +115,68 @@ uint64_t *__template_pml4;
  */
 static bool reinitialise_pgt()
 {
-	// Allocate sixteen pages to mess around with.
-	const PageDescriptor *pages = sys.mm().pgalloc().alloc_pages(4);
+	// Map all of physical memory, and at least the first 4G, where the memory-mapped devices
+	// live.
+	phys_addr_t phys_end = (phys_addr_t)(sys.mm().last_pfn() + 1) << 12;
+	phys_addr_t physmap_size = __max(4 * GB_PAGE_SIZE, __align_up(phys_end, GB_PAGE_SIZE));
+
+	if (physmap_size > PMEM_VA_SIZE) {
+		x86_log.messagef(LogLevel::WARNING, "Physical memory beyond %lu GB will not be mapped", GB(PMEM_VA_SIZE));
+		physmap_size = PMEM_VA_SIZE;
+	}
+
+	unsigned int nr_physmap_gbs = physmap_size / GB_PAGE_SIZE;
+	bool use_gb_pages = !!(cpuid_get_ex_features().rdx & CPUIDFeatures::PDPE1GB);
+
+	// The PML4, and the PDPs for the kernel image and the physical memory map.  Without 1G
+	// pages, there is also a PD for each 1G that they map: 2G of kernel image, and the
+	// physical memory map.
+	unsigned int nr_pages = 3 + (use_gb_pages ? 0 : 2 + nr_physmap_gbs);
+
+	const PageDescriptor *pages = sys.mm().pgalloc().alloc_page_run(nr_pages);
 	if (!pages) {
 		x86_log.message(LogLevel::ERROR, "The page allocator has not worked!");
 		return false;
 	}
 
+	// Until the new tables are loaded, they can only be reached through the kernel image
+	// mapping.
+	if (sys.mm().pgalloc().pgd_to_pa(&pages[nr_pages - 1]) >= KERNEL_VMEM_SIZE) {
+		x86_log.message(LogLevel::ERROR, "Kernel page tables are not in mapped memory");
+		return false;
+	}
+
 	// The PML4 will be the first page.
 	uint64_t *pml4 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[0]);
 
 	// Zero all the pages.
-	bzero(pml4, (1 << 4) * 0x1000);
+	bzero(pml4, nr_pages * 0x1000);
 
 	x86_log.messagef(LogLevel::DEBUG, "Kernel page tables @ %p", pml4);
 
-	// Populate some local variables that will make working with the various
-	// page tables at the various levels a bit easier.
 	uint64_t *pdp0 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[1]);
 	uint64_t *pdp1 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[2]);
-
-	uint64_t *pdp0_pd0 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[3]);
-	uint64_t *pdp0_pd1 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[4]);
-
-	uint64_t *pdp1_pd0 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[5]);
-	uint64_t *pdp1_pd1 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[6]);
-	uint64_t *pdp1_pd2 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[7]);
-	uint64_t *pdp1_pd3 = (uint64_t *)sys.mm().pgalloc().pgd_to_kva(&pages[8]);
+	const PageDescriptor *pd_pool = &pages[3];
 
 	/*
 	 * PML4 -> pdp{0,1}
 	 *
-	 * PDP0 -> pd{0,1}
-	 * PDP1 -> pd{0,1,2,3}
+	 * PDP0 -> the kernel image, in the last 2G
+	 * PDP1 -> the physical memory map
 	 */
 
 	// Fill in the PML4 and PDPs.
-	pml4[0x1ff] = (kva_to_pa((virt_addr_t)pdp0) & ~0xfff) | 0x003;
-	pml4[0x100] = (kva_to_pa((virt_addr_t)pdp1) & ~0xfff) | 0x003;
-
-	pdp0[0x1fe] = (kva_to_pa((virt_addr_t)pdp0_pd0) & ~0xfff) | 0x003;
-	pdp0[0x1ff] = (kva_to_pa((virt_addr_t)pdp0_pd1) & ~0xfff) | 0x003;
-
-	pdp1[0x000] = (kva_to_pa((virt_addr_t)pdp1_pd0) & ~0xfff) | 0x003;
-	pdp1[0x001] = (kva_to_pa((virt_addr_t)pdp1_pd1) & ~0xfff) | 0x003;
-	pdp1[0x002] = (kva_to_pa((virt_addr_t)pdp1_pd2) & ~0xfff) | 0x003;
-	pdp1[0x003] = (kva_to_pa((virt_addr_t)pdp1_pd3) & ~0xfff) | 0x003;
-
-	// Now, fill in the KERNEL PDs
-	uintptr_t addr = 0;
-	for (unsigned int i = 0; i < 0x200; i++) {
-		pdp0_pd0[i] = (addr & ~0xfff) | 0x083;
-		pdp0_pd1[i] = ((addr + 0x40000000) & ~0xfff) | 0x083;
-		addr += 0x200000;
-	}
-
-	// Now, fill in the PHYSMEM PDs for a 4G mapping
-	addr = 0;
-	for (unsigned int i = 0; i < 0x200; i++) {
-		pdp1_pd0[i] = (addr & ~0xfff) | 0x083;
-		addr += 0x200000;
-	}
+	pml4[0x1ff] = (kva_to_pa((virt_addr_t)pdp0) & ~0xfff) | KPTE_TABLE;
+	pml4[0x100] = (kva_to_pa((virt_addr_t)pdp1) & ~0xfff) | KPTE_TABLE;
 
-	for (unsigned int i = 0; i < 0x200; i++) {
-		pdp1_pd1[i] = (addr & ~0xfff) | 0x083;
-		addr += 0x200000;
-	}
+	map_gb(pdp0, 0x1fe, 0, use_gb_pages, pd_pool);
+	map_gb(pdp0, 0x1ff, GB_PAGE_SIZE, use_gb_pages, pd_pool);
 
-	for (unsigned int i = 0; i < 0x200; i++) {
-		pdp1_pd2[i] = (addr & ~0xfff) | 0x083;
-		addr += 0x200000;
+	for (unsigned int i = 0; i < nr_physmap_gbs; i++) {
+		map_gb(pdp1, i, i * GB_PAGE_SIZE, use_gb_pages, pd_pool);
 	}
 
-	for (unsigned int i = 0; i < 0x200; i++) {
-		pdp1_pd3[i] = (addr & ~0xfff) | 0x083;
-		addr += 0x200000;
-	}
+	x86_log.messagef(LogLevel::INFO, "Physical memory map: %u GB, using %s pages", nr_physmap_gbs, use_gb_pages ? "1G" : "2M");
 
 	// Welp, here we go.  Reload the page tables
 	asm volatile ("mov %0, %%cr3" :: "r"(kva_to_pa((virt_addr_t)pml4)));
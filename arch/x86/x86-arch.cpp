@@ -25,6 +25,12 @@ extern "C" {
 	infos::kernel::Thread *current_thread;
 }
 
+#define CR4_PCIDE	(1ull << 17)
+
+// With PCIDs enabled, the low bits of CR3 hold the PCID, and setting the top bit stops the
+// write from flushing the TLB entries tagged with it.
+#define CR3_NOFLUSH	(1ull << 63)
+
 using namespace infos::arch;
 using namespace infos::arch::x86;
 using namespace infos::kernel;
@@ -32,7 +38,7 @@ using namespace infos::util;
 
 X86Arch infos::arch::x86::x86arch;
 Arch& infos::arch::sys_arch = x86arch;
-X86CPU bsp;
+X86CPU bsp(0);
 
 extern "C" void __syscall_trap(void);
 extern void kernel_syscall_handler(const IRQ *irq, void *priv);
@@ -52,7 +58,7 @@ static void trap_interrupt(const IRQ *irq, void *priv)
 	arch_abort();
 }
 
-X86Arch::X86Arch()
+X86Arch::X86Arch() : _pcid_enabled(false)
 {
 	_cpus[0] = &bsp;
 }
@@ -80,6 +86,18 @@ bool X86Arch::init()
 	__wrmsr(MSR_LSTAR, (uint64_t)__syscall_trap);		// RIP for syscall entry
 	__wrmsr(MSR_SFMASK, (1 << 9));
 
+	// PCIDs can only be enabled while the current PCID is 0, which it is until the first
+	// thread is activated.
+	auto features = cpuid_get_features();
+	if (features.rcx & CPUIDFeatures::PCID) {
+		uint64_t cr4;
+		asm volatile("mov %%cr4, %0" : "=r"(cr4));
+		asm volatile("mov %0, %%cr4" :: "r"(cr4 | CR4_PCIDE) : "memory");
+
+		_pcid_enabled = true;
+		x86_log.message(LogLevel::INFO, "PCID enabled");
+	}
+
 //	auto feat = cpuid_get_features();
 //	if (!(feat.rcx & (uint64_t)CPUIDFeatures::OSXSAVE)) {
 //		syslog.message(LogLevel::WARNING, "XSAVE not supported");
@@ -168,7 +186,26 @@ infos::kernel::Thread& X86Arch::get_current_thread() const
 
 void X86Arch::set_current_thread(kernel::Thread& thread)
 {
-	asm volatile("mov %0, %%cr3" :: "r"(thread.owner().vma().pgt_base()) : "memory");
+	mm::VMA& vma = thread.owner().vma();
+	bool flush = vma.take_pending_tlb_flush();
+
+	// Threads of the same process share an address space, so there is nothing to switch.
+	if (flush || !current_thread || &current_thread->owner().vma() != &vma) {
+		uint64_t cr3 = vma.pgt_base();
+
+		// The TLB entries of an address space with its own PCID survive while other
+		// address spaces are loaded, and are only flushed if they may be stale.  PCID 0 is
+		// shared, so it is always flushed.
+		if (_pcid_enabled) {
+			cr3 |= vma.pcid();
+
+			if (vma.pcid() != 0 && !flush) {
+				cr3 |= CR3_NOFLUSH;
+			}
+		}
+
+		asm volatile("mov %0, %%cr3" :: "r"(cr3) : "memory");
+	}
 
 	tss.set_kernel_stack(thread.context().kernel_stack);
 	current_thread = &thread;
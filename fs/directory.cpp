@@ -29,6 +29,7 @@ bool SimpleDirectory::read_entry(DirectoryEntry& entry)
 void SimpleDirectory::close()
 {
 	_entries.clear();
+	_arena.release();
 }
 
 void SimpleDirectory::add_entry(const DirectoryEntry& e)
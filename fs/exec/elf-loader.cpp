@@ -12,6 +12,7 @@
 #include <infos/kernel/process.h>
 #include <infos/mm/mm.h>
 #include <infos/mm/page-allocator.h>
+#include <infos/util/arena.h>
 
 using namespace infos::kernel;
 using namespace infos::fs;
@@ -146,6 +147,9 @@ Process *ElfLoader::load(const String &cmdline)
 
 	bool use_interp = false;
 
+	// The interpreter name is staged in an arena, which is released when loading is complete.
+	Arena arena;
+
 	Process *np = new Process("user", false, (Thread::thread_proc_t)hdr.entry_point);
 	for (unsigned int i = 0; i < hdr.phnum; i++)
 	{
@@ -164,26 +168,48 @@ Process *ElfLoader::load(const String &cmdline)
 		{
 		case ProgramHeaderEntryType::PT_LOAD:
 		{
-			if (!np->vma().is_mapped(ent.vaddr))
+			// The segment is read in from the file a page at a time, as its pages are first
+			// touched.  Whatever is not in the file (i.e. the BSS) is zero-filled.
+			if (ent.filesz > ent.memsz)
+			{
+				delete np;
+
+				elf_log.message(LogLevel::DEBUG, "Invalid segment size");
+				return NULL;
+			}
+
+			mm::MappingFlags::MappingFlags flags = mm::MappingFlags::User;
+			if ((uint32_t)ent.flags & (uint32_t)ProgramHeaderEntryFlags::PF_W)
 			{
-				np->vma().allocate_virt(ent.vaddr, __align_up_page(ent.memsz) >> 12);
+				flags = flags | mm::MappingFlags::Writable;
 			}
 
-			char *buffer = new char[ent.filesz];
-			_file.pread(buffer, ent.filesz, ent.offset);
-			np->vma().copy_to(ent.vaddr, buffer, ent.filesz);
-			delete buffer;
+			if (!np->vma().add_file_region(ent.vaddr, ent.memsz, flags, _file, ent.offset, ent.filesz))
+			{
+				delete np;
+
+				elf_log.message(LogLevel::DEBUG, "Unable to allocate memory for segment");
+				return NULL;
+			}
 		}
 		break;
 
 		case ProgramHeaderEntryType::PT_INTERP:
 		{
-			char *buffer = new char[ent.filesz];
+			char *buffer = (char *)arena.alloc(ent.filesz + 1);
+			if (!buffer)
+			{
+				delete np;
+
+				elf_log.message(LogLevel::DEBUG, "Unable to allocate memory for ELF interpreter");
+				return NULL;
+			}
+
 			_file.pread(buffer, ent.filesz, ent.offset);
+			buffer[ent.filesz] = 0;
 
 			if (strncmp(buffer, "__INFOS_DYNAMIC_LINKER__", ent.filesz) != 0)
 			{
-				delete buffer;
 				delete np;
 
 				elf_log.message(LogLevel::DEBUG, "Unsupported ELF interpreter");
@@ -191,7 +217,6 @@ Process *ElfLoader::load(const String &cmdline)
 			}
 
 			syslog.messagef(LogLevel::DEBUG, "Interp: %s", buffer);
-			delete buffer;
 
 			use_interp = true;
 		}
@@ -203,19 +228,33 @@ Process *ElfLoader::load(const String &cmdline)
 	}
 
 	if (use_interp) {
+		delete np;
+
 		elf_log.message(LogLevel::DEBUG, "Dynamic linked executables not supported");
 		return NULL;
 	}
 
-	np->main_thread().allocate_user_stack(0x100000, 0x2000);
+	if (!np->main_thread().allocate_user_stack(0x2000)) {
+		delete np;
+
+		elf_log.message(LogLevel::ERROR, "Unable to allocate user stack");
+		return NULL;
+	}
 
 	if (cmdline.length() > 0)
 	{
-		virt_addr_t cmdline_start = 0x102000;
-		np->vma().allocate_virt(cmdline_start, 1);
+		// The command-line goes wherever there is room in the address space, with its
+		// terminator, which the zero-filled page provides.
+		virt_addr_t cmdline_start;
+		if (!np->vma().allocate_virt_any(__align_up_page(cmdline.length() + 1) >> __page_bits, cmdline_start))
+		{
+			delete np;
+			return NULL;
+		}
 
 		if (!np->vma().copy_to(cmdline_start, cmdline.c_str(), cmdline.length()))
 		{
+			delete np;
 			return NULL;
 		}
 
@@ -226,5 +265,8 @@ Process *ElfLoader::load(const String &cmdline)
 		np->main_thread().add_entry_argument(NULL);
 	}
 
+	// The segments are read from the file on demand, so the process keeps it.
+	np->vma().adopt_file(&_file);
+
 	return np;
 }
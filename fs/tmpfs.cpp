@@ -30,7 +30,7 @@ PFSNode* TempFSNode::get_child(const util::String& name)
 {
 	TempFSNode *child;
 	
-	if (!_children.try_get_value(name.get_hash(), child)) {
+	if (!_children.try_get_value(name, child)) {
 		return NULL;
 	}
 
@@ -40,7 +40,10 @@ PFSNode* TempFSNode::get_child(const util::String& name)
 PFSNode* TempFSNode::mkdir(const util::String& name)
 {
 	TempFSNode *dir = new TempFSNode((TempFS &)owner(), name);
-	_children.add(name.get_hash(), dir);
+	if (!_children.add(name, dir)) {
+		delete dir;
+		return NULL;
+	}
 	
 	return dir;
 }
@@ -14,10 +14,30 @@
 #include <infos/kernel/log.h>
 #include <infos/fs/vfs.h>
 #include <infos/fs/filesystem.h>
+#include <infos/mm/object-cache.h>
 
 using namespace infos::fs;
 using namespace infos::kernel;
 
+static infos::mm::ObjectCache vfs_node_cache("vfs-node", sizeof(VFSNode));
+
+/**
+ * Allocates a VFS node from the VFS node cache.
+ */
+void *VFSNode::operator new(size_t size)
+{
+	assert(size == sizeof(VFSNode));
+	return vfs_node_cache.alloc();
+}
+
+/**
+ * Returns a VFS node to the VFS node cache.
+ */
+void VFSNode::operator delete(void *p)
+{
+	vfs_node_cache.free(p);
+}
+
 Filesystem *VFSNode::mount(const util::String& fstype, drivers::Device* dev)
 {
 	FilesystemRegistration *fsreg = sys.vfs().lookup_fs(fstype);
@@ -50,14 +70,17 @@ VFSNode* VFSNode::get_child(const util::String& name)
 	if (!_pn) return NULL;
 	
 	VFSNode *child;
-	if (!_children.try_get_value(name.get_hash(), child)) {
+	if (!_children.try_get_value(name, child)) {
 		PFSNode *assoc = _pn->get_child(name);
 		if (!assoc) {
 			return NULL;
 		}
 		
 		child = new VFSNode(this, assoc);
-		_children.add(name.get_hash(), child);
+		if (!_children.add(name, child)) {
+			delete child;
+			return NULL;
+		}
 	}
 	
 	//vfs_log.messagef(LogLevel::DEBUG, "vfsnode: get child %s vfs=%p pfs=%p child-vfs=%p", name.c_str(), this, _pn, child);
@@ -21,7 +21,7 @@ namespace infos
 			class X86CPU : public infos::kernel::CPU
 			{
 			public:
-				X86CPU();
+				X86CPU(unsigned int id);
 			};
 		}
 	}
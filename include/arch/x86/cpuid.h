@@ -50,6 +50,7 @@ namespace infos {
 					CX16 = 1 << 13,
 					ETPRD = 1 << 14,
 					PDCM = 1 << 15,
+					PCID = 1 << 17,
 					DCA = 1 << 18,
 					SSE4_1 = 1 << 19,
 					SSE4_2 = 1 << 20,
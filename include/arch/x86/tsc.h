@@ -0,0 +1,30 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/arch/x86/tsc.h
+ * 
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ * 
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos {
+	namespace arch {
+		namespace x86 {
+			/**
+			 * Reads the processor's time-stamp counter.
+			 * @return Returns the current value of the time-stamp counter.
+			 */
+			static inline uint64_t __rdtsc() {
+				uint32_t low, high;
+
+				asm volatile("rdtsc" : "=a"(low), "=d"(high));
+				return (uint64_t) low | (((uint64_t) high) << 32);
+			}
+		}
+	}
+}
@@ -49,8 +49,11 @@ namespace infos
 				IRQManager& irq_manager() { return _irq_manager; }
 				
 			private:
-				kernel::CPU *_cpus[1];
+				kernel::CPU *_cpus[MAX_CPUS];
 				IRQManager _irq_manager;
+				
+				// True if TLB entries are tagged with the PCID of their address space.
+				bool _pcid_enabled;
 			};
 			
 			extern X86Arch x86arch;
@@ -64,12 +64,21 @@ typedef __gnuc_va_list va_list;
 #define MB(__val) (KB(__val) >> 10)
 #define GB(__val) (MB(__val) >> 10)
 
+#define MAX_CPUS			1
+
+#define CACHE_LINE_SIZE		64
+#define __cacheline_aligned __aligned(CACHE_LINE_SIZE)
+
 #define KERNEL_VMEM_START	((uintptr_t)0xFFFFFFFF80000000u)
 #define KERNEL_VMEM_END		((uintptr_t)0xFFFFFFFFFFFFFFFFu)
 #define KERNEL_VMEM_SIZE	(KERNEL_VMEM_END - KERNEL_VMEM_START + 1)
 
+// The lower half of the address space belongs to user programs.
+#define USER_VMEM_END		((uintptr_t)0x0000800000000000u)
+
+// Physical memory is mapped in a single 512G PML4 slot of the upper half.
 #define PMEM_VA_START		((uintptr_t)0xFFFF800000000000)
-#define PMEM_VA_END			((uintptr_t)0xFFFF800100000000)
+#define PMEM_VA_END			((uintptr_t)0xFFFF808000000000)
 #define PMEM_VA_SIZE		(PMEM_VA_END - PMEM_VA_START)
 
 #define STRINGIFY(__N) _STRINGIFY(__N)
@@ -81,6 +90,10 @@ typedef __gnuc_va_list va_list;
 #define __page_base(__addr) ((__addr) & ~(__page_size - 1))
 #define __page_index(__addr) ((__addr) >> __page_bits)
 
+#define __huge_page_bits 21
+#define __huge_page_size (1 << __huge_page_bits)
+#define __huge_page_offset(__addr) ((__addr) & (__huge_page_size - 1))
+
 /**
  * Converts a physical address into a kernel virtual address.
  * @param pa The physical address to convert.
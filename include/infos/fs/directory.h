@@ -4,6 +4,7 @@
 #include <infos/define.h>
 #include <infos/util/string.h>
 #include <infos/util/list.h>
+#include <infos/util/arena.h>
 
 namespace infos
 {
@@ -28,7 +29,7 @@ namespace infos
 		class SimpleDirectory : public Directory
 		{
 		public:
-			SimpleDirectory() : _current_entry(0) { }
+			SimpleDirectory() : _entries(_arena), _current_entry(0) { }
 			
 			bool read_entry(DirectoryEntry& entry) override;
 			void close() override;
@@ -37,6 +38,9 @@ namespace infos
 			void add_entry(const DirectoryEntry& e);
 			
 		private:
+			// A listing is built up once and thrown away as a whole, so its nodes come from
+			// an arena.
+			util::Arena _arena;
 			util::List<DirectoryEntry> _entries;
 			unsigned int _current_entry;
 		};
@@ -12,6 +12,10 @@ namespace infos
 		
 		namespace exec
 		{
+			/**
+			 * Loads an ELF executable.  If loading succeeds, the new process takes ownership
+			 * of the file, as its segments are read from it on demand.
+			 */
 			class ElfLoader : public Loader
 			{
 			public:
@@ -4,7 +4,7 @@
 #include <infos/fs/filesystem.h>
 #include <infos/fs/directory.h>
 #include <infos/fs/pfs-node.h>
-#include <infos/util/map.h>
+#include <infos/util/hashmap.h>
 
 namespace infos
 {
@@ -29,13 +29,13 @@ namespace infos
 			File* open() override;
 			Directory* opendir() override;
 			
-			const util::Map<util::String::hash_type, TempFSNode *>& children() const { return _children; }
+			const util::HashMap<util::String, TempFSNode *>& children() const { return _children; }
 			
 			const util::String& name() const { return _name; }
 			
 		private:
 			const util::String _name;
-			util::Map<util::String::hash_type, TempFSNode *> _children;
+			util::HashMap<util::String, TempFSNode *> _children;
 		};
 		
 		class TempFSDirectory : public SimpleDirectory
@@ -2,7 +2,7 @@
 #pragma once
 
 #include <infos/fs/fs-node.h>
-#include <infos/util/map.h>
+#include <infos/util/hashmap.h>
 
 namespace infos
 {
@@ -21,6 +21,9 @@ namespace infos
 		public:
 			VFSNode(VFSNode *parent, PFSNode *pn = NULL) : FSNode(parent), _pn(pn) { }
 
+			static void *operator new(size_t size);
+			static void operator delete(void *p);
+
 			VFSNode* get_child(const util::String& name) override;
 			VFSNode* mkdir(const util::String& name) override;
 
@@ -30,7 +33,7 @@ namespace infos
 			
 		private:
 			PFSNode *_pn;
-			util::Map<util::String::hash_type, VFSNode *> _children;
+			util::HashMap<util::String, VFSNode *> _children;
 		};
 	}
 }
@@ -20,9 +20,16 @@ namespace infos
 		class CPU
 		{
 		public:
+			CPU(unsigned int id) : _id(id) { }
+
+			unsigned int id() const { return _id; }
+
 			static CPU& current() {
 				return sys.arch().get_current_cpu();
 			}
+
+		private:
+			unsigned int _id;
 		};
 	}
 }
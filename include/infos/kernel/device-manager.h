@@ -15,7 +15,7 @@
 #include <infos/drivers/device.h>
 #include <infos/util/list.h>
 #include <infos/util/generator.h>
-#include <infos/util/map.h>
+#include <infos/util/hashmap.h>
 
 namespace infos {
 	namespace kernel {
@@ -43,7 +43,7 @@ namespace infos {
 			bool try_get_device_by_name(const util::String& name, T*& __out_device) const
 			{
 				drivers::Device *dev;
-				if (!_devices.try_get_value(name.get_hash(), dev)) {
+				if (!_devices.try_get_value(name, dev)) {
 					return false;
 				}
 				
@@ -51,10 +51,10 @@ namespace infos {
 				return true;
 			}
 			
-			const util::Map<util::String::hash_type, drivers::Device *>& devices() const { return _devices; }
+			const util::HashMap<util::String, drivers::Device *>& devices() const { return _devices; }
 			
 		private:
-			util::Map<util::String::hash_type, drivers::Device *> _devices;
+			util::HashMap<util::String, drivers::Device *> _devices;
 		};
 	}
 }
@@ -26,6 +26,7 @@ namespace infos
 			
 			ObjectHandle register_object(Thread& owner, void *obj);
 			void *get_object_secure(Thread& owner, ObjectHandle handle);
+			bool unregister_object(Thread& owner, ObjectHandle handle);
 			
 		private:
 			util::Mutex _registry_lock;
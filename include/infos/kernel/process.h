@@ -13,6 +13,7 @@
 #include <infos/kernel/thread.h>
 #include <infos/mm/vma.h>
 #include <infos/util/list.h>
+#include <infos/util/intrusive-list.h>
 #include <infos/util/string.h>
 #include <infos/util/event.h>
 
@@ -20,12 +21,21 @@ namespace infos
 {
 	namespace kernel
 	{
-		class Process
+		/**
+		 * A process.  Once a user process terminates, the reaper thread tears down its
+		 * address space, so that the exiting thread does not have to.  The process object
+		 * itself is kept, as handles to it may still be held.
+		 */
+		class Process : public util::IntrusiveListNode<Process>
 		{
 		public:
-			Process(const util::String& name, bool kernel_process, Thread::thread_proc_t entry_point);
+			Process(const util::String& name, bool kernel_process, Thread::thread_proc_t entry_point,
+				SchedulingEntityPriority::SchedulingEntityPriority priority = SchedulingEntityPriority::NORMAL);
 			virtual ~Process();
 
+			static void *operator new(size_t size);
+			static void operator delete(void *p);
+
 			const util::String& name() const { return _name; }
 
 			void start();
@@ -42,6 +52,8 @@ namespace infos
 
 			util::Event& state_changed() { return _state_changed; }
 
+			static void start_reaper();
+
 		private:
 			const util::String _name;
 			bool _kernel_process, _terminated;
@@ -50,6 +62,9 @@ namespace infos
 			Thread *_main_thread;
 
 			util::Event _state_changed;
+
+			bool reap();
+			static void reaper_threadproc();
 		};
 	}
 }
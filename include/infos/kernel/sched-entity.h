@@ -5,6 +5,7 @@
 #include <infos/util/time.h>
 #include <infos/util/event.h>
 #include <infos/util/string.h>
+#include <infos/util/intrusive-rbtree.h>
 
 namespace infos
 {
@@ -34,7 +35,11 @@ namespace infos
             };
         }
 		
-		class SchedulingEntity
+		/**
+		 * A scheduling entity carries its own runqueue links, so that a scheduling algorithm
+		 * can queue it without allocating.
+		 */
+		class SchedulingEntity : public util::IntrusiveRBNode<SchedulingEntity>
 		{
 			friend class Scheduler;
 		public:
@@ -42,7 +47,7 @@ namespace infos
 			typedef util::KernelRuntimeClock::Timepoint EntityStartTime;
 
 			SchedulingEntity(SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name)
-			: _cpu_runtime(0), _exec_start_time(0), _name(name), _state(SchedulingEntityState::STOPPED), _priority(priority) { }
+			: _cpu_runtime(0), _runqueue_key(0), _exec_start_time(0), _name(name), _state(SchedulingEntityState::STOPPED), _priority(priority) { }
 			virtual ~SchedulingEntity() { }
 			
 			virtual bool activate(SchedulingEntity *prev) = 0;
@@ -50,6 +55,13 @@ namespace infos
 			EntityRuntime cpu_runtime() const { return _cpu_runtime; }
 			
 			void increment_cpu_runtime(EntityRuntime delta) { _cpu_runtime += delta; }
+			/**
+			 * The value that the scheduling algorithm ordered this entity by when it was queued,
+			 * which stays fixed while the entity is in the runqueue.
+			 */
+			EntityRuntime runqueue_key() const { return _runqueue_key; }
+			void runqueue_key(EntityRuntime key) { _runqueue_key = key; }
+
 			void update_exec_start_time(EntityStartTime exec_start_time) { _exec_start_time = exec_start_time; }
 
             const util::String& name() const { return _name; }
@@ -62,6 +74,7 @@ namespace infos
 			
 		private:
 			EntityRuntime _cpu_runtime;
+			EntityRuntime _runqueue_key;
 			EntityStartTime _exec_start_time;
 
             const util::String _name;
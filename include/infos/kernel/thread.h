@@ -31,7 +31,7 @@ namespace infos
 			};
 		}
 
-		class Thread : public SchedulingEntity
+		class Thread : public SchedulingEntity, public util::IntrusiveListNode<util::WakeQueue>
 		{
 		public:
 			typedef void (*thread_proc_t)(void *);
@@ -40,6 +40,9 @@ namespace infos
                    SchedulingEntityPriority::SchedulingEntityPriority priority, const util::String& name = "?");
 			virtual ~Thread();
 
+			static void *operator new(size_t size);
+			static void operator delete(void *p);
+
 			ThreadPrivilege::ThreadPrivilege privilege() const { return _privilege; }
 			bool is_kernel_thread() const { return _privilege == ThreadPrivilege::Kernel; }
 
@@ -48,7 +51,7 @@ namespace infos
 			void sleep();
 			void wake_up();
 
-			void allocate_user_stack(virt_addr_t vaddr, size_t size);
+			bool allocate_user_stack(size_t size);
 			void add_entry_argument(void *arg);
 
 			ThreadContext& context() { return _context; }
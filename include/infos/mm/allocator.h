@@ -12,10 +12,27 @@
 
 #include <infos/define.h>
 
+namespace std
+{
+	// The type through which the compiler passes the alignment of over-aligned types to
+	// operator new and operator delete.
+	enum class align_val_t : size_t { };
+}
+
 namespace infos
 {
 	namespace mm
 	{
+		namespace AllocFlags
+		{
+			enum AllocFlags
+			{
+				NONE = 0,
+				ZERO = 1,
+				NOWAIT = 2,
+			};
+		}
+
 		class MemoryManager;
 		
 		class Allocator
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/heap-profile.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/mm/object-allocator.h>
+#include <infos/drivers/device.h>
+
+// Live memory is counted per size class, plus one bucket for allocations that are too large
+// for any class.
+#define HEAPPROF_NR_BUCKETS		(OBJALLOC_NR_SIZE_CLASSES + 1)
+
+// The number of distinct call sites that each CPU can count.  Allocations from call sites
+// that do not fit are counted, but not attributed.
+#define HEAPPROF_NR_CALL_SITES		256
+
+namespace infos
+{
+	namespace mm
+	{
+		struct HeapProfileCallSite
+		{
+			const void *caller;
+			uint64_t nr_allocs, nr_bytes;
+		};
+
+		/**
+		 * The heap profile counters belonging to one CPU.  Objects may be freed on a different
+		 * CPU to the one they were allocated on, so live counts are only meaningful when
+		 * summed across every CPU.
+		 */
+		struct PerCPUHeapProfile
+		{
+			int64_t live_objects[HEAPPROF_NR_BUCKETS];
+			int64_t live_bytes[HEAPPROF_NR_BUCKETS];
+			int64_t total_live_bytes;
+
+			uint64_t nr_allocs, nr_frees;
+			uint64_t nr_unattributed;
+
+			HeapProfileCallSite call_sites[HEAPPROF_NR_CALL_SITES];
+		} __cacheline_aligned;
+
+		/**
+		 * Low-overhead statistics about the kernel heap: how much memory each call site
+		 * allocates, how much memory is live in each size class, and the peak amount of
+		 * live memory.  The counters are per-CPU, and are only updated with interrupts
+		 * disabled, so recording an allocation takes no locks.
+		 */
+		class HeapProfile
+		{
+		public:
+			HeapProfile();
+
+			bool enabled() const { return _enabled; }
+			void enable() { _enabled = true; }
+
+			void record_alloc(const void *caller, int bucket, size_t size);
+			void record_free(int bucket, size_t size);
+
+			int format(char *buffer, int size) const;
+
+		private:
+			bool _enabled;
+			int64_t _peak_live_bytes;
+
+			PerCPUHeapProfile _cpus[MAX_CPUS];
+		};
+
+		/**
+		 * A device that presents the heap profile as text, e.g. /dev/heapprof0.
+		 */
+		class HeapProfileDevice : public drivers::Device
+		{
+		public:
+			static const drivers::DeviceClass HeapProfileDeviceClass;
+
+			const drivers::DeviceClass& device_class() const override { return HeapProfileDeviceClass; }
+
+			fs::File *open_as_file() override;
+		};
+
+		extern HeapProfile heap_profile;
+	}
+}
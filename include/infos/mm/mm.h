@@ -53,6 +53,10 @@ namespace infos
 			
 			void add_physical_memory(phys_addr_t addr, unsigned int nr_pages, MemoryType::MemoryType type);
 			bool initialise_allocators();
+			void start_background_threads();
+			void idle();
+			
+			pfn_t last_pfn() const { return _last_pfn; }
 			
 			PageAllocator& pgalloc() { return _page_alloc; }
 			ObjectAllocator& objalloc() { return _obj_alloc; }
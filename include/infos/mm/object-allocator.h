@@ -14,20 +14,63 @@
 #include <infos/kernel/log.h>
 #include <infos/util/lock.h>
 
+// The number of small-object size classes that are cached in magazines, and the number
+// of objects that each magazine holds.
+#define OBJALLOC_NR_SIZE_CLASSES	10
+#define OBJALLOC_MAGAZINE_SIZE		32
+
 namespace infos
 {
+	namespace kernel
+	{
+		class Thread;
+	}
+	
 	namespace mm
 	{
-		namespace AllocFlags
-		{
-			enum AllocFlags
-			{
-				NONE = 0,
-			};
-		}
-
 		class MemoryManager;
 		
+		/**
+		 * A magazine of recently freed objects, all of the same size class.
+		 */
+		struct ObjectMagazine
+		{
+			ObjectMagazine *next;
+			unsigned int count;
+			void *objects[OBJALLOC_MAGAZINE_SIZE];
+		};
+		
+		/**
+		 * The magazines belonging to one CPU.  Each size class has a loaded magazine, which
+		 * objects are allocated from and freed into, and the previously loaded magazine,
+		 * which is swapped in when the loaded one runs empty or full.
+		 */
+		struct PerCPUMagazines
+		{
+			ObjectMagazine *loaded[OBJALLOC_NR_SIZE_CLASSES];
+			ObjectMagazine *previous[OBJALLOC_NR_SIZE_CLASSES];
+		} __cacheline_aligned;
+		
+		/**
+		 * The shared store of magazines for one size class, which CPUs exchange their
+		 * magazines with.  Magazines on the full list hold at least one object.
+		 */
+		struct MagazineDepot
+		{
+			ObjectMagazine *full, *empty;
+			unsigned int nr_full, nr_empty;
+		};
+		
+		/**
+		 * Statistics about the physical memory held by the heap.
+		 */
+		struct HeapStats
+		{
+			uint64_t nr_pages, peak_nr_pages;
+			uint64_t nr_pages_mapped, nr_pages_unmapped;
+			uint64_t nr_trims;
+		};
+		
 		class ObjectAllocator : Allocator
 		{
 			friend class MemoryManager;
@@ -37,11 +80,56 @@ namespace infos
 			
 			bool init() override;
 			
-			void *alloc(size_t size, AllocFlags::AllocFlags flags = AllocFlags::NONE);
+			void *alloc(size_t size, AllocFlags::AllocFlags flags = AllocFlags::NONE, const void *caller = NULL);
+			void *alloc_aligned(size_t size, size_t align, AllocFlags::AllocFlags flags = AllocFlags::NONE, const void *caller = NULL);
 			void free(void *ptr);
+			void free(void *ptr, size_t size);
+			
+			void idle();
+			void start_maintenance_thread();
+			
+			void *map_heap_pages(size_t size);
+			void unmap_heap_pages(void *addr, size_t size);
+			
+			void trim_heap();
+			
+			const HeapStats& heap_stats() const { return _heap_stats; }
+			
+			static size_t size_class_size(int size_class);
 			
 		private:
 			util::Mutex _mtx;
+			HeapStats _heap_stats;
+			AllocFlags::AllocFlags _heap_flags;
+			
+			bool _magazines_enabled;
+			PerCPUMagazines _magazines[MAX_CPUS];
+			
+			util::Mutex _depot_mtx;
+			MagazineDepot _depots[OBJALLOC_NR_SIZE_CLASSES];
+			
+			// Flushes the magazines and trims the heap in the background, when woken by the
+			// idle loop.
+			kernel::Thread *_maintenance_thread;
+			uint64_t _last_flush;
+			uint64_t _nr_magazine_hits, _nr_magazine_misses;
+			
+			PerCPUMagazines& this_cpu_magazines();
+			
+			void *heap_alloc(size_t size, size_t align, AllocFlags::AllocFlags flags);
+			void heap_free(void *ptr);
+			
+			void *magazine_alloc(int size_class, bool nowait);
+			bool magazine_free(void *ptr, int size_class);
+			
+			ObjectMagazine *depot_take(int size_class, bool full);
+			void depot_put(int size_class, ObjectMagazine *mag);
+			void depot_put_locked(int size_class, ObjectMagazine *mag);
+			
+			void release_magazine_objects_locked(ObjectMagazine *mag);
+			void flush_magazines();
+			
+			static void maintenance_threadproc(ObjectAllocator *objalloc);
 		};
 		
 		extern infos::kernel::ComponentLog objalloc_log;
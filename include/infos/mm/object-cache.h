@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/mm/object-cache.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/lock.h>
+
+namespace infos
+{
+	namespace mm
+	{
+		/**
+		 * A slab cache of fixed-size objects.  Objects are carved out of slabs of contiguous
+		 * pages, taken directly from the page allocator, so allocating and freeing them never
+		 * touches the general-purpose heap.  If a constructor is given, it is run on every
+		 * object when its slab is created, and objects must be freed back to the cache in
+		 * their constructed state.  The free list of such a cache is then linked through a
+		 * word after each object, rather than through the object itself, so that none of the
+		 * constructed state is overwritten while the object is free.
+		 */
+		class ObjectCache
+		{
+		public:
+			typedef void (*Constructor)(void *obj);
+
+			ObjectCache(const char *name, size_t object_size, Constructor ctor = NULL);
+
+			static ObjectCache *create(const char *name, size_t object_size, Constructor ctor = NULL);
+
+			void *alloc();
+			void free(void *obj);
+
+			static void *alloc_sized(size_t size);
+			static void free_sized(void *obj, size_t size);
+
+			const char *name() const { return _name; }
+			size_t object_size() const { return _object_size; }
+
+			uint64_t nr_slabs() const { return _nr_slabs; }
+			uint64_t nr_active_objects() const { return _nr_active; }
+
+		private:
+			struct Slab
+			{
+				Slab *next, *prev;
+				void *free_objects;
+				unsigned int nr_free;
+			};
+
+			const char *_name;
+			size_t _object_size;
+			Constructor _ctor;
+
+			// The offset within each object's slot of the free list link, and the size of
+			// each slot.
+			size_t _link_offset, _slot_size;
+
+			int _slab_order;
+			unsigned int _objects_per_slab;
+
+			// Slabs with free objects, and slabs without.  At most one completely free slab
+			// is kept on the partial list; the rest are given back to the page allocator.
+			Slab *_partial, *_full;
+			unsigned int _nr_empty;
+
+			uint64_t _nr_slabs, _nr_active;
+
+			util::Mutex _mtx;
+
+			unsigned int objects_per_slab(int order) const;
+			Slab *slab_of(void *obj) const;
+			void *& free_link(void *obj) const { return *(void **)((uintptr_t)obj + _link_offset); }
+
+			Slab *grow();
+			void release(Slab *slab);
+
+			static void link(Slab *& list, Slab *slab);
+			static void unlink(Slab *& list, Slab *slab);
+		};
+	}
+}
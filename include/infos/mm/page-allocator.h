@@ -16,6 +16,11 @@
 
 namespace infos
 {
+	namespace kernel
+	{
+		class Thread;
+	}
+
 	namespace mm
 	{
 		namespace PageDescriptorType
@@ -26,19 +31,148 @@ namespace infos
 				RESERVED = 1,
 				AVAILABLE = 2,
 				ALLOCATED = 3,
+				CACHED = 4,
 			};
 		}
 
-		struct PageDescriptor
+		namespace PageDescriptorFlags
 		{
-			PageDescriptor *next_free;
-			PageDescriptor *prev_free;
+			enum PageDescriptorFlags
+			{
+				NONE = 0,
+				FREE_BLOCK_HEAD = 1,
+
+				// An allocated page whose contents can be moved elsewhere by remapping it, and
+				// an allocated page that has been taken out of use by memory compaction.
+				MOVABLE = 2,
+				ISOLATED = 4,
+			};
+		}
+
+		struct PageDescriptor;
+
+		/**
+		 * The standard page descriptor layout, which links free blocks with native pointers.
+		 */
+		struct WidePageDescriptorLayout
+		{
+			PageDescriptor *_next_free;
+			PageDescriptor *_prev_free;
 			PageDescriptorType::PageDescriptorType type;
+
+			// Allocation algorithm private state: the order of the free block
+			// this page heads, and any descriptor flags.
+			uint8_t order;
+			uint8_t flags;
 		} __aligned(16);
 
+		/**
+		 * The compact page descriptor layout, which links free blocks with 32-bit offsets
+		 * relative to the descriptor itself (zero meaning no link), and stores the type in a
+		 * single byte.  The links are only meaningful in the descriptor heading a free block.
+		 */
+		struct CompactPageDescriptorLayout
+		{
+			int32_t _next_free;
+			int32_t _prev_free;
+			uint8_t type;
+			uint8_t order;
+			uint8_t flags;
+		};
+
+#ifdef PGALLOC_COMPACT_DESCRIPTORS
+		typedef CompactPageDescriptorLayout PageDescriptorLayout;
+#else
+		typedef WidePageDescriptorLayout PageDescriptorLayout;
+#endif
+
+		struct PageDescriptor : PageDescriptorLayout
+		{
+#ifdef PGALLOC_COMPACT_DESCRIPTORS
+			PageDescriptor *next_free() const { return link_target(_next_free); }
+			void next_free(PageDescriptor *pgd) { _next_free = link_to(pgd); }
+
+			PageDescriptor *prev_free() const { return link_target(_prev_free); }
+			void prev_free(PageDescriptor *pgd) { _prev_free = link_to(pgd); }
+
+		private:
+			PageDescriptor *link_target(int32_t link) const
+			{
+				return link ? const_cast<PageDescriptor *>(this) + link : NULL;
+			}
+
+			int32_t link_to(const PageDescriptor *pgd) const
+			{
+				return pgd ? (int32_t)(pgd - this) : 0;
+			}
+#else
+			PageDescriptor *next_free() const { return _next_free; }
+			void next_free(PageDescriptor *pgd) { _next_free = pgd; }
+
+			PageDescriptor *prev_free() const { return _prev_free; }
+			void prev_free(PageDescriptor *pgd) { _prev_free = pgd; }
+#endif
+		};
+
+		static_assert(sizeof(PageDescriptor) == sizeof(PageDescriptorLayout), "page descriptors must not carry extra state");
+
 		class MemoryManager;
 		class ObjectAllocator;
 
+// Deferred page descriptor initialisation works on sections of 2^PGALLOC_SECTION_ORDER
+// pages.  Allocation algorithms must not look at descriptors outside of a naturally aligned
+// block of this size when handling pages inside it.
+#define PGALLOC_SECTION_ORDER	16
+#define PGALLOC_SECTION_PAGES	(1ull << PGALLOC_SECTION_ORDER)
+
+// The number of orders that are cached per-CPU, and the capacity of each cache.
+#define PCP_MAX_ORDER	2
+#define PCP_MAX_PAGES	256
+
+// The order of a huge (2M) page.
+#define HUGE_PAGE_ORDER	(__huge_page_bits - __page_bits)
+
+// The maximum capacity of the pool of pre-zeroed pages.
+#define ZERO_POOL_MAX_PAGES	1024
+
+// The number of orders for which fragmentation indices are calculated.
+#define FRAG_MAX_ORDER	11
+
+		/**
+		 * A per-CPU cache of free blocks of a single order.  The cache is a ring: the
+		 * "hot" end holds recently freed (and so probably cache-warm) blocks, which are
+		 * handed out first, and the "cold" end is drained back to the allocation algorithm.
+		 */
+		struct PageCacheList
+		{
+			PageDescriptor *blocks[PCP_MAX_PAGES];
+			unsigned int first, count;
+
+			void push_hot(PageDescriptor *pgd) { blocks[(first + count++) % PCP_MAX_PAGES] = pgd; }
+			PageDescriptor *pop_hot() { return blocks[(first + --count) % PCP_MAX_PAGES]; }
+
+			void push_cold(PageDescriptor *pgd)
+			{
+				first = (first + PCP_MAX_PAGES - 1) % PCP_MAX_PAGES;
+				blocks[first] = pgd;
+				count++;
+			}
+
+			PageDescriptor *pop_cold()
+			{
+				PageDescriptor *pgd = blocks[first];
+				first = (first + 1) % PCP_MAX_PAGES;
+				count--;
+
+				return pgd;
+			}
+		};
+
+		struct PerCPUPageCache
+		{
+			PageCacheList lists[PCP_MAX_ORDER];
+		};
+
 		class PageAllocatorAlgorithm
 		{
 		public:
@@ -50,6 +184,9 @@ namespace infos
 			virtual PageDescriptor *allocate_pages(int order) = 0;
 			virtual void free_pages(PageDescriptor *base, int order) = 0;
 
+			virtual unsigned int allocate_pages_bulk(unsigned int nr_pages, PageDescriptor **pgds);
+			virtual void free_pages_bulk(PageDescriptor **pgds, unsigned int nr_pages);
+
 			virtual const char *name() const = 0;
 
 			virtual void dump_state() const;
@@ -68,13 +205,38 @@ namespace infos
 			PageAllocatorAlgorithm *algorithm() const { return _allocator_algorithm; }
 			void algorithm(PageAllocatorAlgorithm &alg) { _allocator_algorithm = &alg; }
 
-			PageDescriptor *alloc_pages(int order);
+			PageDescriptor *alloc_pages(int order, AllocFlags::AllocFlags flags = AllocFlags::NONE);
 			void free_pages(PageDescriptor *pgd, int order);
+			void free_cold_pages(PageDescriptor *pgd, int order);
+
+			PageDescriptor *alloc_page_run(uint64_t nr_pages, AllocFlags::AllocFlags flags = AllocFlags::NONE);
+			void free_page_run(PageDescriptor *pgd, uint64_t nr_pages);
+
+			unsigned int alloc_pages_bulk(unsigned int nr_pages, PageDescriptor **pgds, AllocFlags::AllocFlags flags = AllocFlags::NONE);
+			void free_pages_bulk(PageDescriptor **pgds, unsigned int nr_pages);
+
+			void drain_page_caches();
+
+			void start_deferred_init();
+			bool init_deferred_section();
+
+			void start_zeroing_thread();
+			void start_compaction_thread();
+			void idle();
+
+			PageDescriptor *compact(int order);
+			void fragmentation_indices(int *indices);
+
+			uint64_t zero_pool_hits() const { return _zero_pool_hits; }
+			uint64_t zero_pool_misses() const { return _zero_pool_misses; }
 
 			inline const PageDescriptor *alloc_page() { return alloc_pages(0); }
 			const PageDescriptor *alloc_zero_page();
 			inline void free_page(PageDescriptor *pgd) { return free_pages(pgd, 0); }
 
+			inline PageDescriptor *alloc_huge_page(AllocFlags::AllocFlags flags = AllocFlags::NONE) { return alloc_pages(HUGE_PAGE_ORDER, flags); }
+			inline void free_huge_page(PageDescriptor *pgd) { return free_pages(pgd, HUGE_PAGE_ORDER); }
+
 			pfn_t pgd_to_pfn(const PageDescriptor *pgd) const
 			{
 				uintptr_t offset = (uintptr_t)pgd - (uintptr_t)_page_descriptors;
@@ -118,15 +280,65 @@ namespace infos
 			PageAllocatorAlgorithm *_allocator_algorithm;
 			util::Mutex _mtx;
 
+			pfn_t _deferred_pfn;
+			uint64_t _nr_deferred_pages;
+			uint64_t _deferred_init_cycles;
+
+			PerCPUPageCache _pcp[MAX_CPUS];
+			unsigned int _pcp_high, _pcp_low;
+
+			PageDescriptor *_zero_pool[ZERO_POOL_MAX_PAGES];
+			unsigned int _nr_zero_pool, _zero_pool_high, _zero_pool_low;
+			uint64_t _zero_pool_hits, _zero_pool_misses;
+			kernel::Thread *_zeroing_thread;
+
+			util::Mutex _compact_mtx;
+			kernel::Thread *_compaction_thread;
+			uint64_t _last_compaction;
+			uint64_t _nr_compactions, _nr_compaction_failures;
+
+			PageDescriptor *take_pages_locked(int order, PageDescriptorType::PageDescriptorType type);
+			void return_pages_locked(PageDescriptor *pgd, int order);
+			unsigned int take_pages_bulk_locked(unsigned int nr_pages, PageDescriptor **pgds);
+
+			PerCPUPageCache& this_cpu_page_cache();
+			PageDescriptor *pcp_alloc_pages(int order);
+			void pcp_free_pages(PageDescriptor *pgd, int order, bool cold);
+			void pcp_drain(PageCacheList& list, int order, unsigned int target);
+
+			unsigned int take_zeroed_pages(PageDescriptor **pgds, unsigned int nr_pages);
+			void drain_zero_pool();
+			void refill_zero_pool();
+			static void zeroing_threadproc(PageAllocator *pgalloc);
+
+			pfn_t find_compaction_block(int order);
+			bool isolate_block(pfn_t start, int order);
+			void release_isolated_pages(pfn_t start, int order);
+			static void compaction_threadproc(PageAllocator *pgalloc);
+			void compaction_idle();
+
+			uint64_t init_page_range(pfn_t start, pfn_t end);
+			uint64_t count_present_pages(pfn_t start, pfn_t end) const;
+			static void deferred_init_threadproc(PageAllocator *pgalloc);
+
 			bool setup_page_descriptors();
 			bool self_test();
+			void benchmark();
+			void benchmark_run(int api);
 			uint64_t reserve_page_range(pfn_t start, uint64_t nr_pages);
 		};
 
 		extern infos::kernel::ComponentLog pgalloc_log;
 
+// Algorithms register themselves in a section that the kernel's linker script collects.  The
+// host build of the algorithms uses a section named with a plain identifier instead, so that
+// the host linker provides the bounds of it.
+#ifndef PGALLOC_REGISTRATION_SECTION
+#define PGALLOC_REGISTRATION_SECTION ".pgallocptr"
+#endif
+
 #define RegisterPageAllocator(_class) \
 	static _class __pgalloc_class;    \
-	__section(".pgallocptr") infos::mm::PageAllocatorAlgorithm *__pgalloc_ptr_##_class = &__pgalloc_class
+	__section(PGALLOC_REGISTRATION_SECTION) infos::mm::PageAllocatorAlgorithm *__pgalloc_ptr_##_class = &__pgalloc_class
 	}
 }
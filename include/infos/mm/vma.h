@@ -3,10 +3,18 @@
 #pragma once
 
 #include <infos/define.h>
-#include <infos/util/list.h>
+#include <infos/util/vector.h>
+#include <infos/util/hashmap.h>
+#include <infos/util/intrusive-rbtree.h>
+#include <infos/util/lock.h>
 
 namespace infos
 {
+	namespace fs
+	{
+		class File;
+	}
+	
 	namespace mm
 	{
 		class PageDescriptor;
@@ -27,6 +35,52 @@ namespace infos
 			}
 		}
 		
+		namespace RegionBacking
+		{
+			enum RegionBacking
+			{
+				Anonymous,
+				File
+			};
+		}
+		
+		/**
+		 * A range of a VMA's address space whose pages are allocated and mapped when they are
+		 * first touched.  Anonymous regions are zero-filled.  File-backed regions take the
+		 * contents of part of the region from a file, and zero-fill the rest, like an ELF
+		 * segment and its BSS.
+		 *
+		 * The regions of a VMA never overlap, but a region need not start or end on a page
+		 * boundary, so neighbouring regions can share a page.
+		 */
+		struct VMARegion : util::IntrusiveRBNode<VMARegion>
+		{
+			virt_addr_t start, end;
+			MappingFlags::MappingFlags flags;
+			RegionBacking::RegionBacking backing;
+			
+			// The file contents are placed at [data_start, data_end), from file_offset.
+			fs::File *file;
+			off_t file_offset;
+			virt_addr_t data_start, data_end;
+			
+			// Summaries of the region's subtree: the range of addresses it spans, and the
+			// size of the largest page-aligned gap between its regions.
+			virt_addr_t subtree_start, subtree_end;
+			size_t subtree_max_gap;
+			
+			struct Order
+			{
+				bool operator()(const VMARegion& l, const VMARegion& r) const { return l.start < r.start; }
+			};
+			
+			struct Augment
+			{
+				static const bool enabled = true;
+				static void update(VMARegion& region, VMARegion *left, VMARegion *right);
+			};
+		};
+		
 		class VMA
 		{
 		public:
@@ -34,12 +88,34 @@ namespace infos
 			virtual ~VMA();
 			
 			phys_addr_t pgt_base() const { return _pgt_phys_base; }
+			uint16_t pcid() const { return _pcid; }
+			
+			/**
+			 * Returns true if the TLB entries tagged with the VMA's PCID may be stale, and
+			 * must be flushed as the VMA is loaded, and clears the flag.
+			 */
+			bool take_pending_tlb_flush()
+			{
+				bool pending = _tlb_flush_pending;
+				_tlb_flush_pending = false;
+				
+				return pending;
+			}
+			
+			void release();
+			bool try_release();
 			
 			PageDescriptor *allocate_phys(int order);
-			bool allocate_virt(virt_addr_t va, int nr_pages);
-			bool allocate_virt_any(int nr_pages);
+			bool allocate_virt_any(int nr_pages, virt_addr_t& va);
+			
+			bool add_anonymous_region(virt_addr_t va, size_t size, MappingFlags::MappingFlags flags);
+			bool add_file_region(virt_addr_t va, size_t size, MappingFlags::MappingFlags flags, fs::File& file, off_t file_offset, size_t file_size);
+			void adopt_file(fs::File *file);
+			
+			bool handle_fault(virt_addr_t va, bool write);
 			
 			void insert_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFlags flags);
+			void insert_huge_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFlags flags);
 			bool get_mapping(virt_addr_t va, phys_addr_t& pa);
 			bool is_mapped(virt_addr_t va);
 			
@@ -48,6 +124,8 @@ namespace infos
 			bool copy_to(virt_addr_t dest_va, const void *src, size_t size);
 			
 			void dump();
+			
+			static bool migrate_range(pfn_t start, pfn_t end);
 					
 		private:
 			struct PageAllocation
@@ -56,11 +134,59 @@ namespace infos
 				int allocation_order;
 			};
 			
-			util::List<PageAllocation> _page_allocations;
+			util::Vector<PageAllocation> _page_allocations;
+			
+			// The index in _page_allocations of each movable page, so that migrating a page
+			// can find its entry without a search.
+			util::HashMap<PageDescriptor *, unsigned int> _movable_allocations;
+			
+			// The regions of the address space, ordered by their start address.
+			typedef util::IntrusiveRBTree<VMARegion, VMARegion::Order, VMARegion, VMARegion::Augment> RegionTree;
+			RegionTree _regions;
+			
+			// Files that back regions of this VMA, which are deleted along with it.
+			util::Vector<fs::File *> _files;
 			
 			phys_addr_t _pgt_phys_base;
 			virt_addr_t _pgt_virt_base;
 			
+			// The PCID that tags the VMA's TLB entries, or 0 if it does not have one of its
+			// own.
+			uint16_t _pcid;
+			bool _tlb_flush_pending;
+			
+			// Serialises changes to the page tables with page migration.
+			util::Mutex _mtx;
+			
+			// Every VMA is kept on a global list, so that page migration can find the
+			// mappings of a physical page.
+			VMA *_next_vma, *_prev_vma;
+			static VMA *_vma_list;
+			static util::Mutex _vma_list_mtx;
+			
+			void release_locked();
+			
+			bool add_region(VMARegion *region);
+			VMARegion *first_region_ending_after(virt_addr_t va) const;
+			bool find_free_range(size_t size, virt_addr_t& va) const;
+			static bool find_gap(VMARegion *region, virt_addr_t floor, size_t size, virt_addr_t& va);
+			bool populate(virt_addr_t va, bool write);
+			bool populate_region(const VMARegion& region);
+			
+			PageDescriptor *allocate_tracked(int order);
+			bool track_allocation(PageDescriptor *pgd, int order);
+			void mark_movable(PageDescriptor *pgd, unsigned int index);
+			void replace_allocation(PageDescriptor *old_pgd, PageDescriptor *new_pgd);
+			bool migrate_pages(pfn_t start, pfn_t end);
+			
+			PageDescriptor *next_table_page(PageDescriptor **& table_pool, unsigned int& nr_table_pool);
+			void map_page(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFlags flags, bool huge, PageDescriptor **& table_pool, unsigned int& nr_table_pool);
+			bool can_map_huge(virt_addr_t va);
+			bool map_huge_page(virt_addr_t va, MappingFlags::MappingFlags flags);
+			bool is_zero_fill_huge(virt_addr_t va) const;
+			bool populate_anonymous(const VMARegion& region);
+			unsigned int count_missing_tables(virt_addr_t va, unsigned int nr_pages);
+			
 			void dump_pdp(int pml4, virt_addr_t pdp_va);
 			void dump_pd(int pml4, int pdp, virt_addr_t pd_va);
 			void dump_pt(int pml4, int pdp, int pd, virt_addr_t pt_va);
@@ -2,9 +2,7 @@
 
 #pragma once
 
-#include <infos/kernel/kernel.h>
-#include <infos/mm/mm.h>
-#include <infos/mm/object-allocator.h>
+#include <infos/define.h>
 
 namespace infos
 {
@@ -20,15 +18,8 @@ namespace infos
 		class DefaultAllocator : public Allocator
 		{
 		public:
-			void* alloc(size_t size) override
-			{
-				return infos::kernel::sys.mm().objalloc().alloc(size);
-			}
-			
-			void free(void* ptr) override
-			{
-				return infos::kernel::sys.mm().objalloc().free(ptr);
-			}
+			void* alloc(size_t size) override;
+			void free(void* ptr) override;
 		};
 	}
 }
@@ -0,0 +1,73 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/util/arena.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/allocator.h>
+
+// Allocations from an arena are aligned to this boundary by default.
+#define ARENA_DEFAULT_ALIGN	16ul
+
+namespace infos
+{
+	namespace util
+	{
+		/**
+		 * A bump allocator for temporary objects that all die together.  Memory is taken
+		 * from the page allocator in whole pages, and handed out by bumping a pointer.
+		 * Individual objects are never freed: everything is given back at once when the
+		 * arena is released or destroyed.  Objects with destructors must be destroyed
+		 * before the arena is released.
+		 */
+		class Arena : public Allocator
+		{
+		public:
+			Arena() : _chunks(NULL), _next(0), _end(0), _chunk_pages(1), _nr_pages(0) { }
+			~Arena() { release(); }
+
+			Arena(const Arena&) = delete;
+			Arena& operator=(const Arena&) = delete;
+
+			void *alloc(size_t size) override { return alloc(size, ARENA_DEFAULT_ALIGN); }
+
+			void *alloc(size_t size, size_t align)
+			{
+				uintptr_t ptr = (_next + align - 1) & ~(align - 1);
+
+				if (_end && ptr <= _end && _end - ptr >= size) {
+					_next = ptr + size;
+					return (void *)ptr;
+				}
+
+				return alloc_slow(size, align);
+			}
+
+			void free(void *ptr) override { }
+
+			void release();
+
+			uint64_t nr_pages() const { return _nr_pages; }
+
+		private:
+			struct Chunk
+			{
+				Chunk *next;
+				uint64_t nr_pages;
+			};
+
+			Chunk *_chunks;
+			uintptr_t _next, _end;
+			uint64_t _chunk_pages, _nr_pages;
+
+			void *alloc_slow(size_t size, size_t align);
+		};
+	}
+}
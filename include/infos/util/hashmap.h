@@ -0,0 +1,385 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/infos/util/hashmap.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/support.h>
+#include <infos/util/string.h>
+
+// The smallest table that a hash map allocates.
+#define HASHMAP_MIN_CAPACITY		8
+
+// While a hash map is being resized, each insertion or removal moves at most this many
+// slots of the old table into the new one.
+#define HASHMAP_MIGRATE_BATCH		16
+
+namespace infos
+{
+	namespace util
+	{
+		/**
+		 * Hashes keys for a HashMap.  The default hashes integers and pointers; other key types
+		 * need a specialisation.
+		 */
+		template<typename T>
+		struct Hash
+		{
+			static uint64_t hash(const T& key)
+			{
+				uint64_t h = (uint64_t)key * 0x9e3779b97f4a7c15ull;
+				return h ^ (h >> 29);
+			}
+		};
+
+		template<>
+		struct Hash<String>
+		{
+			static uint64_t hash(const String& key) { return key.get_hash(); }
+		};
+
+		template<typename TKey, typename TValue>
+		struct HashMapPair
+		{
+			HashMapPair(const TKey& key, TValue& value) : key(key), value(value) { }
+
+			const TKey& key;
+			TValue& value;
+		};
+
+		/**
+		 * A hash table with open addressing and linear probing.  Alongside the slots, each
+		 * table keeps a byte per slot holding the top bits of the slot's hash, so most probes
+		 * only touch that array, and keys are only compared for equality when those bits match.
+		 *
+		 * Growing the table does not rehash every entry at once: the old table is kept, and
+		 * entries are moved across a batch at a time as the map is modified.  Lookups look in
+		 * both tables until the move is complete.
+		 */
+		template<typename TKey, typename TValue, typename THash = Hash<TKey>>
+		class HashMap
+		{
+			// Slot control bytes.  Full slots hold the top seven bits of their hash, with the
+			// top bit set.
+			enum SlotControl : uint8_t
+			{
+				EMPTY = 0,
+				DELETED = 1,
+				FULL = 0x80,
+			};
+
+			struct Slot
+			{
+				TKey key;
+				TValue value;
+			};
+
+			struct Table
+			{
+				uint8_t *control;
+				Slot *slots;
+				unsigned int capacity, count, nr_deleted;
+			};
+
+		public:
+			typedef HashMap<TKey, TValue, THash> Self;
+			typedef HashMapPair<TKey, TValue> Pair;
+
+			class Iterator
+			{
+			public:
+				Iterator(const Self *map, const Table *table, unsigned int index) : _map(map), _table(table), _index(index) { skip_free(); }
+
+				Pair operator*() const { return Pair(_table->slots[_index].key, _table->slots[_index].value); }
+
+				void operator++()
+				{
+					_index++;
+					skip_free();
+				}
+
+				bool operator==(const Iterator& other) const { return _table == other._table && _index == other._index; }
+				bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+			private:
+				const Self *_map;
+				const Table *_table;
+				unsigned int _index;
+
+				// Moves forward to the next full slot, going on to the old table after the
+				// current one.
+				void skip_free()
+				{
+					while (_table) {
+						while (_index < _table->capacity && !(_table->control[_index] & FULL)) {
+							_index++;
+						}
+
+						if (_index < _table->capacity) return;
+
+						if (_table == &_map->_table && _map->_old.capacity) {
+							_table = &_map->_old;
+							_index = 0;
+						} else {
+							_table = NULL;
+							_index = 0;
+						}
+					}
+				}
+			};
+
+			HashMap() : _migrate_pos(0)
+			{
+				bzero(&_table, sizeof(_table));
+				bzero(&_old, sizeof(_old));
+			}
+
+			HashMap(const Self&) = delete;
+			HashMap(Self&&) = delete;
+
+			~HashMap()
+			{
+				release(_table);
+				release(_old);
+			}
+
+			/**
+			 * Adds a value to the map, replacing the value of the key if it is already present.
+			 * @return Returns false if there was not enough memory to grow the map.
+			 */
+			bool add(TKey const& key, TValue const& value)
+			{
+				uint64_t hash = THash::hash(key);
+
+				migrate();
+
+				int index = find(_table, key, hash);
+				if (index >= 0) {
+					_table.slots[index].value = value;
+					return true;
+				}
+
+				if (_old.capacity) {
+					index = find(_old, key, hash);
+					if (index >= 0) {
+						_old.slots[index].value = value;
+						return true;
+					}
+				}
+
+				// Entries still in the old table are counted, so that there is always room to
+				// move them across.
+				if ((count() + _table.nr_deleted + 1) * 4 > _table.capacity * 3) {
+					if (!grow()) return false;
+				}
+
+				insert(_table, key, value, hash);
+				return true;
+			}
+
+			/**
+			 * Removes a key from the map.
+			 * @return Returns true if the key was present.
+			 */
+			bool remove(TKey const& key)
+			{
+				uint64_t hash = THash::hash(key);
+
+				migrate();
+
+				int index = find(_table, key, hash);
+				if (index >= 0) {
+					erase(_table, index);
+					return true;
+				}
+
+				if (_old.capacity) {
+					index = find(_old, key, hash);
+					if (index >= 0) {
+						erase(_old, index);
+						return true;
+					}
+				}
+
+				return false;
+			}
+
+			void clear()
+			{
+				release(_table);
+				release(_old);
+
+				_migrate_pos = 0;
+			}
+
+			bool contains_key(TKey const& key) const
+			{
+				return lookup(key) != NULL;
+			}
+
+			bool try_get_value(TKey const& key, TValue& value) const
+			{
+				const Slot *slot = lookup(key);
+				if (!slot) return false;
+
+				value = slot->value;
+				return true;
+			}
+
+			unsigned int count() const { return _table.count + _old.count; }
+			bool empty() const { return count() == 0; }
+
+			Iterator begin() const { return Iterator(this, &_table, 0); }
+			Iterator end() const { return Iterator(this, NULL, 0); }
+
+		private:
+			Table _table, _old;
+			unsigned int _migrate_pos;
+
+			static inline uint8_t control_of(uint64_t hash) { return FULL | (hash >> 57); }
+
+			/**
+			 * Returns the index of the slot holding a key, or -1 if the key is not in the table.
+			 */
+			static int find(const Table& table, TKey const& key, uint64_t hash)
+			{
+				if (!table.capacity) return -1;
+
+				unsigned int mask = table.capacity - 1;
+				uint8_t control = control_of(hash);
+
+				for (unsigned int index = hash & mask;; index = (index + 1) & mask) {
+					uint8_t c = table.control[index];
+
+					if (c == EMPTY) return -1;
+					if (c == control && table.slots[index].key == key) return index;
+				}
+			}
+
+			const Slot *lookup(TKey const& key) const
+			{
+				uint64_t hash = THash::hash(key);
+
+				int index = find(_table, key, hash);
+				if (index >= 0) return &_table.slots[index];
+
+				index = find(_old, key, hash);
+				if (index >= 0) return &_old.slots[index];
+
+				return NULL;
+			}
+
+			/**
+			 * Puts a key that is not already present into a table, which must have room for it.
+			 */
+			static void insert(Table& table, TKey const& key, TValue const& value, uint64_t hash)
+			{
+				unsigned int mask = table.capacity - 1;
+				unsigned int index = hash & mask;
+
+				while (table.control[index] & FULL) {
+					index = (index + 1) & mask;
+				}
+
+				if (table.control[index] == DELETED) {
+					table.nr_deleted--;
+				}
+
+				table.control[index] = control_of(hash);
+				new (&table.slots[index]) Slot { key, value };
+				table.count++;
+			}
+
+			static void erase(Table& table, unsigned int index)
+			{
+				table.slots[index].~Slot();
+				table.control[index] = DELETED;
+				table.count--;
+				table.nr_deleted++;
+			}
+
+			static void release(Table& table)
+			{
+				for (unsigned int i = 0; i < table.capacity; i++) {
+					if (table.control[i] & FULL) {
+						table.slots[i].~Slot();
+					}
+				}
+
+				delete[] table.control;
+				::operator delete(table.slots);
+
+				bzero(&table, sizeof(table));
+			}
+
+			/**
+			 * Starts moving the entries into a new table, which is large enough that it will
+			 * not fill up before they have all been moved.
+			 * @return Returns false if the new table could not be allocated.
+			 */
+			bool grow()
+			{
+				// Only one resize can be in progress at a time.
+				while (_old.capacity) {
+					migrate();
+				}
+
+				unsigned int capacity = HASHMAP_MIN_CAPACITY;
+				while (capacity < (_table.count + 1) * 2) {
+					capacity <<= 1;
+				}
+
+				Table table;
+				table.control = new uint8_t[capacity];
+				table.slots = (Slot *)::operator new(capacity * sizeof(Slot));
+				table.capacity = capacity;
+				table.count = 0;
+				table.nr_deleted = 0;
+
+				if (!table.control || !table.slots) {
+					delete[] table.control;
+					::operator delete(table.slots);
+					return false;
+				}
+
+				bzero(table.control, capacity);
+
+				_old = _table;
+				_table = table;
+				_migrate_pos = 0;
+
+				return true;
+			}
+
+			/**
+			 * Moves a batch of entries from the old table to the new one, and frees the old
+			 * table once it is empty.
+			 */
+			void migrate()
+			{
+				if (!_old.capacity) return;
+
+				unsigned int end = __min(_migrate_pos + HASHMAP_MIGRATE_BATCH, _old.capacity);
+				for (; _migrate_pos < end; _migrate_pos++) {
+					if (!(_old.control[_migrate_pos] & FULL)) continue;
+
+					Slot& slot = _old.slots[_migrate_pos];
+					insert(_table, slot.key, slot.value, THash::hash(slot.key));
+					erase(_old, _migrate_pos);
+				}
+
+				if (_migrate_pos == _old.capacity) {
+					release(_old);
+					_migrate_pos = 0;
+				}
+			}
+		};
+	}
+}
@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/util/intrusive-list.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace util
+	{
+		/**
+		 * The links of an intrusive list.  A node that is not on a list points at itself.
+		 */
+		struct IntrusiveListLink
+		{
+			IntrusiveListLink *prev, *next;
+
+			IntrusiveListLink() : prev(this), next(this) { }
+			IntrusiveListLink(const IntrusiveListLink&) = delete;
+
+			bool linked() const { return next != this; }
+		};
+
+		/**
+		 * An element of an intrusive list inherits from IntrusiveListNode, once for each list
+		 * it can be on.  The tag tells the nodes apart, and is usually the type of the list's
+		 * owner.
+		 */
+		template<typename Tag>
+		struct IntrusiveListNode : IntrusiveListLink { };
+
+		/**
+		 * A doubly-linked list whose links live inside its elements, so that adding and removing
+		 * elements never allocates.  An element can only be on one list per tag, and the list
+		 * does not own its elements.
+		 */
+		template<typename T, typename Tag = T>
+		class IntrusiveList
+		{
+		public:
+			typedef IntrusiveListNode<Tag> Node;
+
+			class Iterator
+			{
+			public:
+				Iterator(IntrusiveListLink *current) : _current(current) { }
+
+				T& operator*() const { return elem_of(_current); }
+				void operator++() { _current = _current->next; }
+
+				bool operator==(const Iterator& other) const { return _current == other._current; }
+				bool operator!=(const Iterator& other) const { return _current != other._current; }
+
+			private:
+				IntrusiveListLink *_current;
+			};
+
+			IntrusiveList() : _count(0) { }
+			IntrusiveList(const IntrusiveList&) = delete;
+
+			void append(T& elem) { insert_before(_head, node_of(elem)); }
+			void push(T& elem) { insert_before(*_head.next, node_of(elem)); }
+
+			void remove(T& elem)
+			{
+				IntrusiveListLink& node = node_of(elem);
+				assert(node.linked());
+
+				node.prev->next = node.next;
+				node.next->prev = node.prev;
+				node.prev = node.next = &node;
+
+				_count--;
+			}
+
+			T *first() const { return empty() ? NULL : &elem_of(_head.next); }
+			T *last() const { return empty() ? NULL : &elem_of(_head.prev); }
+
+			T *pop_front()
+			{
+				T *elem = first();
+				if (elem) remove(*elem);
+
+				return elem;
+			}
+
+			unsigned int count() const { return _count; }
+			bool empty() const { return _count == 0; }
+
+			Iterator begin() { return Iterator(_head.next); }
+			Iterator end() { return Iterator(&_head); }
+
+		private:
+			IntrusiveListLink _head;
+			unsigned int _count;
+
+			static IntrusiveListLink& node_of(T& elem) { return static_cast<Node&>(elem); }
+			static T& elem_of(IntrusiveListLink *link) { return static_cast<T&>(*static_cast<Node *>(link)); }
+
+			void insert_before(IntrusiveListLink& next, IntrusiveListLink& node)
+			{
+				assert(!node.linked());
+
+				node.prev = next.prev;
+				node.next = &next;
+				next.prev->next = &node;
+				next.prev = &node;
+
+				_count++;
+			}
+		};
+	}
+}
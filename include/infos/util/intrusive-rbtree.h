@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/util/intrusive-rbtree.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+
+namespace infos
+{
+	namespace util
+	{
+		/**
+		 * The links of an intrusive red-black tree.  A node that is not in a tree is its own
+		 * parent.
+		 */
+		struct IntrusiveRBLink
+		{
+			IntrusiveRBLink *parent, *left, *right;
+			bool red;
+
+			IntrusiveRBLink() : parent(this), left(NULL), right(NULL), red(false) { }
+			IntrusiveRBLink(const IntrusiveRBLink&) = delete;
+
+			bool linked() const { return parent != this; }
+		};
+
+		/**
+		 * An element of an intrusive red-black tree inherits from IntrusiveRBNode, once for
+		 * each tree it can be in.  The tag tells the nodes apart.
+		 */
+		template<typename Tag>
+		struct IntrusiveRBNode : IntrusiveRBLink { };
+
+		/**
+		 * The rebalancing operations of a red-black tree, which only deal in links and so are
+		 * shared by every tree.
+		 */
+		class IntrusiveRBTreeBase
+		{
+		public:
+			typedef void (*AugmentFn)(IntrusiveRBLink *node);
+
+			unsigned int count() const { return _count; }
+			bool empty() const { return _count == 0; }
+
+		protected:
+			IntrusiveRBTreeBase(AugmentFn augment) : _root(NULL), _leftmost(NULL), _count(0), _augment(augment) { }
+			IntrusiveRBTreeBase(const IntrusiveRBTreeBase&) = delete;
+
+			void link(IntrusiveRBLink *node, IntrusiveRBLink *parent, bool left);
+			void erase(IntrusiveRBLink *node);
+
+			static IntrusiveRBLink *next(IntrusiveRBLink *node);
+
+			IntrusiveRBLink *_root, *_leftmost;
+			unsigned int _count;
+
+		private:
+			// Recomputes a node's augmented data from its children, or NULL if the tree is
+			// not augmented.
+			AugmentFn _augment;
+
+			void propagate(IntrusiveRBLink *node);
+
+			void rotate_left(IntrusiveRBLink *node);
+			void rotate_right(IntrusiveRBLink *node);
+			void replace(IntrusiveRBLink *node, IntrusiveRBLink *replacement);
+
+			void insert_fixup(IntrusiveRBLink *node);
+			void erase_fixup(IntrusiveRBLink *node, IntrusiveRBLink *parent);
+		};
+
+		/**
+		 * The default for trees that keep no augmented data.
+		 */
+		struct IntrusiveRBNoAugment
+		{
+			static const bool enabled = false;
+
+			template<typename T>
+			static void update(T& elem, T *left, T *right) { }
+		};
+
+		/**
+		 * A red-black tree whose links live inside its elements, so that inserting and removing
+		 * elements never allocates.  Elements are ordered by Less, which compares two elements,
+		 * and elements that compare equal are kept in the order they were inserted.  An
+		 * element's ordering must not change while it is in the tree.
+		 *
+		 * A tree can be augmented with data that summarises each subtree, e.g. the highest
+		 * address in it: Augment::update(elem, left, right) is called to recompute an element's
+		 * data from its children whenever they change.
+		 */
+		template<typename T, typename Less, typename Tag = T, typename Augment = IntrusiveRBNoAugment>
+		class IntrusiveRBTree : public IntrusiveRBTreeBase
+		{
+		public:
+			typedef IntrusiveRBNode<Tag> Node;
+
+			IntrusiveRBTree() : IntrusiveRBTreeBase(Augment::enabled ? augment : NULL) { }
+
+			void insert(T& elem)
+			{
+				IntrusiveRBLink *node = &node_of(elem);
+				assert(!node->linked());
+
+				IntrusiveRBLink *parent = NULL;
+				bool left = false;
+
+				for (IntrusiveRBLink *cur = _root; cur; cur = left ? cur->left : cur->right) {
+					parent = cur;
+					left = Less()(elem, elem_of(cur));
+				}
+
+				link(node, parent, left);
+			}
+
+			void remove(T& elem)
+			{
+				assert(node_of(elem).linked());
+				erase(&node_of(elem));
+			}
+
+			/**
+			 * Returns the lowest-ordered element in the tree, or NULL if the tree is empty.
+			 */
+			T *first() const { return _leftmost ? &elem_of(_leftmost) : NULL; }
+
+			/**
+			 * Returns the element that follows the given element, or NULL if it is the last.
+			 */
+			T *next(T& elem) const
+			{
+				IntrusiveRBLink *node = IntrusiveRBTreeBase::next(&node_of(elem));
+				return node ? &elem_of(node) : NULL;
+			}
+
+			// The structure of the tree, for searches that are guided by augmented data.
+			T *root() const { return elem_or_null(_root); }
+			static T *left(T& elem) { return elem_or_null(node_of(elem).left); }
+			static T *right(T& elem) { return elem_or_null(node_of(elem).right); }
+
+		private:
+			static IntrusiveRBLink& node_of(T& elem) { return static_cast<Node&>(elem); }
+			static T& elem_of(IntrusiveRBLink *link) { return static_cast<T&>(*static_cast<Node *>(link)); }
+			static T *elem_or_null(IntrusiveRBLink *link) { return link ? &elem_of(link) : NULL; }
+
+			static void augment(IntrusiveRBLink *link)
+			{
+				Augment::update(elem_of(link), elem_or_null(link->left), elem_or_null(link->right));
+			}
+		};
+	}
+}
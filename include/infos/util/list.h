@@ -12,6 +12,8 @@
 
 #include <infos/define.h>
 #include <infos/util/support.h>
+#include <infos/util/allocator.h>
+#include <infos/mm/object-cache.h>
 
 namespace infos
 {
@@ -23,8 +25,14 @@ namespace infos
 			typedef T Elem;
 			typedef ListNode<T> Self;
 			
-			Self *Next;
+			Self *Next, *Prev;
 			Elem Data;
+			
+			static void *operator new(size_t size) { return mm::ObjectCache::alloc_sized(size); }
+			static void operator delete(void *p, size_t size) { mm::ObjectCache::free_sized(p, size); }
+
+			static void *operator new(size_t size, Allocator& allocator) { return allocator.alloc(size); }
+			static void operator delete(void *p, Allocator& allocator) { allocator.free(p); }
 		};
 		
 		template<typename T>
@@ -42,10 +50,22 @@ namespace infos
 				return _current->Data;
 			}
 			
+			Elem& operator*() {
+				return _current->Data;
+			}
+			
 			void operator++() {
 				if (_current)
 					_current = _current->Next;
 			}
+
+			/**
+			 * Returns the node that the iterator is positioned at, which can be passed to
+			 * List::remove_node to remove it in constant time.
+			 */
+			Node *node() const {
+				return _current;
+			}
 			
 			bool operator==(const Self& other) const {
 				return _current == other._current;
@@ -70,68 +90,95 @@ namespace infos
 			typedef ListNode<Elem> Node;
 			typedef ListIterator<Elem> Iterator;
 			
-			List() : _elems(NULL), _count(0) { }
+			List() : _elems(NULL), _tail(NULL), _count(0), _allocator(NULL) { }
+			
+			/**
+			 * Constructs a list whose nodes are allocated from the given allocator, which must
+			 * outlive the list.
+			 */
+			explicit List(Allocator& allocator) : _elems(NULL), _tail(NULL), _count(0), _allocator(&allocator) { }
 			
 			// Copy
-			List(const Self& r) : _elems(NULL), _count(0) {
+			List(const Self& r) : _elems(NULL), _tail(NULL), _count(0), _allocator(NULL) {
 				for (const auto& elem : r) {
 					append(elem);
 				}
 			}
 
 			// Move
-			List(Self&& r) : _elems(r._elems), _count(r._count) { r._elems = NULL; r._count = 0; }
+			List(Self&& r) : _elems(r._elems), _tail(r._tail), _count(r._count), _allocator(r._allocator) { r._elems = NULL; r._tail = NULL; r._count = 0; }
 			
 			~List() {
 				Node *node = _elems;
 				while (node) {
 					Node *next = node->Next;
-					delete node;
+					free_node(node);
 					node = next;
 				}
 			}
 			
-			void append(Elem const& elem) {
-				Node **slot = &_elems;
+			/**
+			 * Appends an element to the list.
+			 * @return Returns the node holding the element, which can later be passed to
+			 * remove_node.
+			 */
+			Node *append(Elem const& elem) {
+				Node *node = alloc_node();
+				node->Data = elem;
+				node->Next = NULL;
+				node->Prev = _tail;
 				
-				while (*slot != NULL) {
-					slot = &(*slot)->Next;
+				if (_tail) {
+					_tail->Next = node;
+				} else {
+					_elems = node;
 				}
 				
-				*slot = new Node();
-				(*slot)->Data = elem;
-				(*slot)->Next = NULL;				
-				
+				_tail = node;
 				_count++;
+				
+				return node;
 			}
 			
 			void remove(Elem const& elem) {
-				Node **slot = &_elems;
+				Node *candidate = _elems;
 				
-				while (*slot && (*slot)->Data != elem) {
-					slot = &(*slot)->Next;
+				while (candidate && candidate->Data != elem) {
+					candidate = candidate->Next;
 				}
 				
-				if (*slot) {
-					Node *candidate = *slot;
-					assert(candidate->Data == elem);
-					
-					*slot = candidate->Next;
-										
-					delete candidate;
-					_count--;
-				}	
+				if (candidate) {
+					remove_node(candidate);
+				}
 			}
 			
-			Elem dequeue() {
-				assert(_elems);
+			/**
+			 * Removes the element held in a node of this list, in constant time.
+			 */
+			void remove_node(Node *node) {
+				assert(node);
+				
+				if (node->Prev) {
+					node->Prev->Next = node->Next;
+				} else {
+					_elems = node->Next;
+				}
 				
-				Node *front = _elems;
+				if (node->Next) {
+					node->Next->Prev = node->Prev;
+				} else {
+					_tail = node->Prev;
+				}
 				
-				Elem ret = front->Data;
-				_elems = front->Next;
-				delete front;
+				free_node(node);
 				_count--;
+			}
+			
+			Elem dequeue() {
+				assert(_elems);
+				
+				Elem ret = _elems->Data;
+				remove_node(_elems);
 				
 				return ret;
 			}
@@ -143,11 +190,18 @@ namespace infos
 			
 			void push(Elem const& elem)
 			{
-				Node *node = new Node();
+				Node *node = alloc_node();
 				node->Data = elem;
 				node->Next = _elems;
-				_elems = node;
+				node->Prev = NULL;
+				
+				if (_elems) {
+					_elems->Prev = node;
+				} else {
+					_tail = node;
+				}
 				
+				_elems = node;
 				_count++;
 			}
 			
@@ -161,14 +215,8 @@ namespace infos
 			}
 
 			Elem const& last() const {
-				assert(_elems);
-				
-				Node *last = _elems;
-				while (last->Next) {
-					last = last->Next;
-				}
-				
-				return last->Data;
+				assert(_tail);
+				return _tail->Data;
 			}
 			
 			Elem const& at(int index) const {
@@ -196,10 +244,11 @@ namespace infos
 				while (cur) {
 					Node *tmp = cur;
 					cur = tmp->Next;
-					delete tmp;
+					free_node(tmp);
 				}
 				
 				_elems = NULL;
+				_tail = NULL;
 				_count = 0;
 			}
 			
@@ -214,8 +263,28 @@ namespace infos
 			}
 			
 		private:			
-			Node *_elems;
+			Node *_elems, *_tail;
 			unsigned int _count;
+			Allocator *_allocator;
+			
+			Node *alloc_node()
+			{
+				if (_allocator) {
+					return new (*_allocator) Node();
+				}
+				
+				return new Node();
+			}
+			
+			void free_node(Node *node)
+			{
+				if (_allocator) {
+					node->~Node();
+					_allocator->free(node);
+				} else {
+					delete node;
+				}
+			}
 		};
 	}
 }
@@ -43,6 +43,7 @@ namespace infos
 			
 			void lock() override;
 			void unlock() override;
+			bool try_lock();
 			
 			bool locked() { return !!_locked; }
 			bool locked_by_me();
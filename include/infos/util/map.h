@@ -11,7 +11,7 @@
 #pragma once
 
 #include <infos/define.h>
-#include <infos/util/list.h>
+#include <infos/mm/object-cache.h>
 
 namespace infos {
 	namespace util {
@@ -45,6 +45,9 @@ namespace infos {
 				if (Right) delete Right;
 			}
 			
+			static void *operator new(size_t size) { return mm::ObjectCache::alloc_sized(size); }
+			static void operator delete(void *p, size_t size) { mm::ObjectCache::free_sized(p, size); }
+			
 			inline bool i_am_left() const {
 				assert(parent());
 				return this == parent()->Left;
@@ -127,17 +130,16 @@ namespace infos {
 			const typename TNode::ValueType& value;
 		};
 
+		/**
+		 * Walks a map in key order, by following parent pointers, so iterating never allocates.
+		 */
 		template<typename TNode>
 		class MapIterator {
 		public:
 			typedef MapIteratorPair<TNode> Pair;
 			typedef MapIterator<TNode> Self;
 
-			MapIterator(const TNode *root) : _current(root) {
-				if (root) {
-					_queue.enqueue(root);
-					advance();
-				}
+			MapIterator(const TNode *current) : _current(current) {
 			}
 
 			const Pair operator*() const {
@@ -146,7 +148,20 @@ namespace infos {
 			}
 
 			void operator++() {
-				advance();
+				assert(_current);
+
+				if (_current->right()) {
+					_current = _current->right();
+					while (_current->left()) {
+						_current = _current->left();
+					}
+				} else {
+					while (_current->parent() && _current->i_am_right()) {
+						_current = _current->parent();
+					}
+
+					_current = _current->parent();
+				}
 			}
 
 			bool operator==(const Self& other) const {
@@ -158,24 +173,22 @@ namespace infos {
 			}
 
 		private:
-			List<const TNode *> _queue;
 			const TNode *_current;
+		};
 
-			void advance() {
-				if (!_queue.empty()) {
-					_current = _queue.dequeue();
+		/**
+		 * A range of a map, between two iterators, that can be used in a range-based for loop.
+		 */
+		template<typename TIterator>
+		struct MapRange {
+			MapRange(TIterator first, TIterator last) : _first(first), _last(last) {
+			}
 
-					if (_current->left()) {
-						_queue.enqueue(_current->left());
-					}
+			TIterator begin() const { return _first; }
+			TIterator end() const { return _last; }
 
-					if (_current->right()) {
-						_queue.enqueue(_current->right());
-					}
-				} else {
-					_current = NULL;
-				}
-			}
+		private:
+			TIterator _first, _last;
 		};
 
 		template<typename TKey, typename TValue>
@@ -185,6 +198,7 @@ namespace infos {
 			typedef MapIterator<Node> Iterator;
 			typedef const MapIterator<Node> ConstIterator;
 			typedef Map<TKey, TValue> Self;
+			typedef MapRange<Iterator> Range;
 			
 			Map(const Self&) = delete;
 			Map(Self&&) = delete;
@@ -235,8 +249,62 @@ namespace infos {
 				}
 			}
 
-			void remove(TKey const& key) {
-				// TODO
+			/**
+			 * Removes a key from the map.
+			 * @return Returns true if the key was present.
+			 */
+			bool remove(TKey const& key) {
+				Node *node = find(key);
+				if (!node) return false;
+
+				// The child that moves up into the place of the node that is taken out of the
+				// tree, which may be NULL, and the parent that it ends up with.
+				Node *child, *parent;
+				bool removed_black = node->black();
+
+				if (!node->left()) {
+					child = node->right();
+					parent = node->parent();
+					replace(node, child);
+				} else if (!node->right()) {
+					child = node->left();
+					parent = node->parent();
+					replace(node, child);
+				} else {
+					// The node has two children, so its successor takes its place.
+					Node *successor = node->right();
+					while (successor->left()) {
+						successor = successor->left();
+					}
+
+					removed_black = successor->black();
+					child = successor->right();
+
+					if (successor->parent() == node) {
+						parent = successor;
+					} else {
+						parent = successor->parent();
+						replace(successor, successor->right());
+						successor->right(node->right());
+					}
+
+					replace(node, successor);
+					successor->left(node->left());
+					successor->Colour = node->Colour;
+				}
+
+				// Detach the node's children, so that deleting it does not delete them.
+				node->left(NULL);
+				node->right(NULL);
+				delete node;
+
+				_count--;
+
+				if (removed_black) {
+					rebalance_remove(child, parent);
+				}
+
+				return true;
 			}
 
 			void clear() {
@@ -245,54 +313,116 @@ namespace infos {
 				_count = 0;
 			}
 
-			bool contains_key(TKey const& key) {
+			bool contains_key(TKey const& key) const {
+				return find(key) != NULL;
+			}
+
+			bool try_get_value(TKey const& key, TValue& value) const {
+				Node *node = find(key);
+				if (!node) return false;
+
+				value = node->Value;
+				return true;
+			}
+
+			ConstIterator begin() const {
 				Node *node = _root;
+				while (node && node->left()) {
+					node = node->left();
+				}
+
+				return Iterator(node);
+			}
+
+			ConstIterator end() const {
+				return Iterator(NULL);
+			}
+			
+			/**
+			 * Returns an iterator positioned at the first key that is not less than the given key.
+			 */
+			ConstIterator lower_bound(TKey const& key) const {
+				Node *node = _root, *bound = NULL;
 
 				while (node) {
-					if (key < node->Key) {
-						node = node->left();
-					} else if (key > node->Key) {
+					if (node->Key < key) {
 						node = node->right();
 					} else {
-						return true;
+						bound = node;
+						node = node->left();
 					}
 				}
 
-				return false;
+				return Iterator(bound);
 			}
 
-			bool try_get_value(TKey const& key, TValue& value) const {
-				Node *node = _root;
+			/**
+			 * Returns an iterator positioned at the first key that is greater than the given key.
+			 */
+			ConstIterator upper_bound(TKey const& key) const {
+				Node *node = _root, *bound = NULL;
 
 				while (node) {
 					if (key < node->Key) {
+						bound = node;
 						node = node->left();
-					} else if (key > node->Key) {
-						node = node->right();
 					} else {
-						value = node->Value;
-						return true;
+						node = node->right();
 					}
 				}
 
-				return false;
+				return Iterator(bound);
 			}
 
-			ConstIterator begin() const {
-				return Iterator(_root);
+			/**
+			 * Returns the entries whose keys lie in the range [first, last).
+			 */
+			Range range(TKey const& first, TKey const& last) const {
+				return Range(lower_bound(first), lower_bound(last));
 			}
 
-			ConstIterator end() const {
-				return Iterator(NULL);
-			}
-			
 			unsigned int count() const { return _count; }
+			bool empty() const { return _count == 0; }
 			
 			Node *root() const { return _root; }
 
 		private:
 			Node *_root;
 			unsigned int _count;
+
+			Node *find(TKey const& key) const {
+				Node *node = _root;
+
+				while (node) {
+					if (key < node->Key) {
+						node = node->left();
+					} else if (key > node->Key) {
+						node = node->right();
+					} else {
+						return node;
+					}
+				}
+
+				return NULL;
+			}
+
+			/**
+			 * Puts a replacement node, which may be NULL, in the place of a node under its parent.
+			 */
+			void replace(Node *n, Node *replacement)
+			{
+				if (n->parent() == NULL) {
+					_root = replacement;
+
+					if (replacement) {
+						replacement->clear_parent();
+					}
+				} else if (n->i_am_left()) {
+					n->parent()->left(replacement);
+				} else {
+					n->parent()->right(replacement);
+				}
+			}
 						
 			void rotate_right(Node *n)
 			{
@@ -383,6 +513,76 @@ namespace infos {
 				
 				_root->Colour = Node::BLACK;
 			}
+
+			static inline bool is_black(Node *n)
+			{
+				return !n || n->black();
+			}
+
+			void rebalance_remove(Node *x, Node *parent)
+			{
+				while (x != _root && is_black(x)) {
+					if (x == parent->left()) {
+						Node *w = parent->right();
+						if (w->red()) {
+							w->Colour = Node::BLACK;
+							parent->Colour = Node::RED;
+							rotate_left(parent);
+							w = parent->right();
+						}
+
+						if (is_black(w->left()) && is_black(w->right())) {
+							w->Colour = Node::RED;
+							x = parent;
+							parent = x->parent();
+						} else {
+							if (is_black(w->right())) {
+								w->left()->Colour = Node::BLACK;
+								w->Colour = Node::RED;
+								rotate_right(w);
+								w = parent->right();
+							}
+
+							w->Colour = parent->Colour;
+							parent->Colour = Node::BLACK;
+							w->right()->Colour = Node::BLACK;
+							rotate_left(parent);
+							x = _root;
+						}
+					} else {
+						Node *w = parent->left();
+						if (w->red()) {
+							w->Colour = Node::BLACK;
+							parent->Colour = Node::RED;
+							rotate_right(parent);
+							w = parent->left();
+						}
+
+						if (is_black(w->left()) && is_black(w->right())) {
+							w->Colour = Node::RED;
+							x = parent;
+							parent = x->parent();
+						} else {
+							if (is_black(w->left())) {
+								w->right()->Colour = Node::BLACK;
+								w->Colour = Node::RED;
+								rotate_left(w);
+								w = parent->left();
+							}
+
+							w->Colour = parent->Colour;
+							parent->Colour = Node::BLACK;
+							w->left()->Colour = Node::BLACK;
+							rotate_right(parent);
+							x = _root;
+						}
+					}
+				}
+
+				if (x) {
+					x->Colour = Node::BLACK;
+				}
+			}
 		};
 	}
 }
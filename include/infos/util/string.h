@@ -18,6 +18,7 @@ namespace infos {
         extern size_t strlen(const char *str);
         extern int strncmp(const char *str1, const char *str2, size_t n);
         extern char *strncpy(char *dst, const char *src, size_t n);
+        extern unsigned long strtoul(const char *str, const char **end, int base);
 
         extern "C" void *memcpy(void *dest, const void *src, size_t n);
         extern "C" void *memset(void *dest, int c, size_t n);
@@ -68,12 +69,13 @@ namespace infos {
             : _size(str._size),
             _data(str._data),
             _has_hash(str._has_hash),
-            _hash(str._has_hash) {
-
+            _hash(str._hash) {
+                str._data = NULL;
+                str._size = 0;
             }
 
             ~String() {
-                delete _data;
+                delete[] _data;
             }
 
             /**
@@ -148,7 +150,7 @@ namespace infos {
 
             String& operator=(const String& s) {
                 if (this != &s) {
-                    delete _data;
+                    delete[] _data;
 
                     _size = s._size;
                     _data = new char[_size + 1];
@@ -165,7 +167,7 @@ namespace infos {
 
             String& operator=(String&& s) {
                 if (this != &s) {
-                    delete _data;
+                    delete[] _data;
 
                     _size = s._size;
                     _data = s._data;
@@ -2,6 +2,10 @@
 
 #pragma once
 
+// Placement new, for constructing objects in storage that has already been allocated.
+inline void *operator new(__SIZE_TYPE__, void *p) noexcept { return p; }
+inline void operator delete(void *, void *) noexcept { }
+
 namespace infos {
 	namespace util {
 
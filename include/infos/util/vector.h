@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * include/util/vector.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/define.h>
+#include <infos/util/support.h>
+
+namespace infos
+{
+	namespace util
+	{
+		/**
+		 * A growable array.  Elements are stored contiguously, so appending is amortised
+		 * constant time and iterating touches no more memory than the elements themselves.
+		 * Appending may move the elements, so pointers to them are only valid until the next
+		 * append.
+		 */
+		template<typename T>
+		class Vector
+		{
+		public:
+			typedef T Elem;
+			typedef Vector<T> Self;
+			typedef T *Iterator;
+			typedef const T *ConstIterator;
+
+			Vector() : _elems(NULL), _count(0), _capacity(0) { }
+			Vector(const Self&) = delete;
+
+			Vector(Self&& r) : _elems(r._elems), _count(r._count), _capacity(r._capacity)
+			{
+				r._elems = NULL;
+				r._count = r._capacity = 0;
+			}
+
+			~Vector()
+			{
+				clear();
+				::operator delete(_elems);
+			}
+
+			/**
+			 * Appends an element.
+			 * @return Returns false if there was not enough memory to grow the vector.
+			 */
+			bool append(Elem const& elem)
+			{
+				if (_count == _capacity && !reserve(_capacity ? _capacity * 2 : 8)) {
+					return false;
+				}
+
+				new (&_elems[_count++]) Elem(elem);
+				return true;
+			}
+
+			/**
+			 * Removes the element at the given index, by moving the last element into its
+			 * place.  The order of the elements is not preserved.
+			 */
+			void remove_at(unsigned int index)
+			{
+				assert(index < _count);
+
+				_count--;
+				if (index != _count) {
+					_elems[index] = Move(_elems[_count]);
+				}
+
+				_elems[_count].~Elem();
+			}
+
+			/**
+			 * Makes room for at least the given number of elements.
+			 * @return Returns false if the memory could not be allocated.
+			 */
+			bool reserve(unsigned int capacity)
+			{
+				if (capacity <= _capacity) return true;
+
+				Elem *elems = (Elem *)::operator new(capacity * sizeof(Elem));
+				if (!elems) return false;
+
+				for (unsigned int i = 0; i < _count; i++) {
+					new (&elems[i]) Elem(Move(_elems[i]));
+					_elems[i].~Elem();
+				}
+
+				::operator delete(_elems);
+
+				_elems = elems;
+				_capacity = capacity;
+				return true;
+			}
+
+			/**
+			 * Makes room for at least the given number of elements on top of those already
+			 * in the vector.  The capacity grows geometrically, as it does when appending,
+			 * so that repeatedly reserving a few more elements is still amortised constant
+			 * time per element.
+			 * @return Returns false if the memory could not be allocated.
+			 */
+			bool reserve_additional(unsigned int nr_elems)
+			{
+				if (_count + nr_elems <= _capacity) return true;
+
+				return reserve(__max(_count + nr_elems, _capacity * 2));
+			}
+
+			void clear()
+			{
+				for (unsigned int i = 0; i < _count; i++) {
+					_elems[i].~Elem();
+				}
+
+				_count = 0;
+			}
+
+			Elem& operator[](unsigned int index) { assert(index < _count); return _elems[index]; }
+			Elem const& operator[](unsigned int index) const { assert(index < _count); return _elems[index]; }
+
+			unsigned int count() const { return _count; }
+			bool empty() const { return _count == 0; }
+
+			Iterator begin() { return _elems; }
+			Iterator end() { return _elems + _count; }
+			ConstIterator begin() const { return _elems; }
+			ConstIterator end() const { return _elems + _count; }
+
+		private:
+			Elem *_elems;
+			unsigned int _count, _capacity;
+		};
+	}
+}
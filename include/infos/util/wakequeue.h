@@ -3,7 +3,7 @@
 #pragma once
 
 #include <infos/define.h>
-#include <infos/util/list.h>
+#include <infos/util/intrusive-list.h>
 
 namespace infos
 {
@@ -14,6 +14,10 @@ namespace infos
 
 	namespace util
 	{
+		/**
+		 * A queue of sleeping threads.  Threads are linked through their own wait queue node,
+		 * so a thread can sleep on at most one wake queue at a time.
+		 */
 		class WakeQueue
 		{
 		public:
@@ -21,7 +25,7 @@ namespace infos
             void wake();
 
 		private:
-			util::List<kernel::Thread *> _waiters;
+			IntrusiveList<kernel::Thread, WakeQueue> _waiters;
 		};
 	}
 }
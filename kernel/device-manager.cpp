@@ -31,7 +31,10 @@ bool DeviceManager::register_device(drivers::Device& device)
 	device.assign_name(String(device.device_class().name) + ToString(instance));
 	
 	dm_log.messagef(LogLevel::DEBUG, "registering device '%s'", device.name().c_str());
-	_devices.add(device.name().get_hash(), &device);
+	if (!_devices.add(device.name(), &device)) {
+		dm_log.messagef(LogLevel::ERROR, "unable to register device '%s'", device.name().c_str());
+		return false;
+	}
 		
 	if (!device.init(*this)) {
 		dm_log.messagef(LogLevel::ERROR, "device '%s' failed to initialise", device.name().c_str());
@@ -45,7 +48,5 @@ bool DeviceManager::add_device_alias(const util::String& name, drivers::Device&
 {
 	// TODO: Check to make sure 'device' exists.
 	dm_log.messagef(LogLevel::DEBUG, "registering device alias '%s' for '%s'", name.c_str(), device.name().c_str());
-	_devices.add(name.get_hash(), &device);
-	
-	return true;
+	return _devices.add(name, &device);
 }
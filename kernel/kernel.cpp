@@ -97,6 +97,9 @@ void Kernel::start_kernel_threadproc()
 {
 	DefaultSyscalls::RegisterDefaultSyscalls(syscalls());
 
+	mm().start_background_threads();
+	Process::start_reaper();
+
 	if (!vfs().init()) {
 		syslog.message(LogLevel::FATAL, "Unable to initialise the FS subsystem");
 		arch_abort();
@@ -262,8 +265,9 @@ Process *Kernel::launch_process(const String& path, const String& cmdline)
 
 		syslog.messagef(LogLevel::DEBUG, "Starting process... %p", np->main_thread().context().native_context->rdi);
 		np->start();
+
+		// The image now belongs to the process.
 		delete loader;
-		delete image;
 
 		return np;
 	} else {
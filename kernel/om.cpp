@@ -36,6 +36,8 @@ ObjectHandle ObjectManager::register_object(Thread& owner, void* obj)
 
 void* ObjectManager::get_object_secure(Thread& owner, ObjectHandle handle)
 {
+	util::UniqueLock<util::Mutex> l(_registry_lock);
+	
 	ObjectDescriptor obj;
 	if (!_objects.try_get_value(handle, obj)) {
 		return NULL;
@@ -47,3 +49,23 @@ void* ObjectManager::get_object_secure(Thread& owner, ObjectHandle handle)
 	
 	return obj.object;
 }
+
+/**
+ * Releases a handle, so that it no longer refers to its object.
+ * @return Returns false if the handle does not belong to the owner's process.
+ */
+bool ObjectManager::unregister_object(Thread& owner, ObjectHandle handle)
+{
+	util::UniqueLock<util::Mutex> l(_registry_lock);
+	
+	ObjectDescriptor obj;
+	if (!_objects.try_get_value(handle, obj)) {
+		return false;
+	}
+	
+	if (&obj.owner->owner() != &owner.owner()) {
+		return false;
+	}
+	
+	return _objects.remove(handle);
+}
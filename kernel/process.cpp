@@ -9,17 +9,32 @@
  * Tom Spink <tspink@inf.ed.ac.uk>
  */
 #include <infos/kernel/process.h>
+#include <infos/mm/object-cache.h>
+#include <infos/util/lock.h>
 
 using namespace infos::kernel;
+using namespace infos::util;
 
-Process::Process(const util::String& name, bool kernel_process, Thread::thread_proc_t entry_point)
+static infos::mm::ObjectCache process_cache("process", sizeof(Process));
+
+// Terminated processes whose address spaces are waiting to be torn down, and the thread
+// that tears them down.
+static IntrusiveList<Process> reap_queue;
+static Thread *reaper_thread;
+
+// Terminated processes whose address spaces were busy when the reaper got to them.  They are
+// tried again the next time the reaper is woken.  Only the reaper touches this list.
+static IntrusiveList<Process> busy_reap_queue;
+
+Process::Process(const util::String& name, bool kernel_process, Thread::thread_proc_t entry_point,
+		SchedulingEntityPriority::SchedulingEntityPriority priority)
 	: _name(name), _kernel_process(kernel_process), _terminated(false), _vma()
 {
 	// Initialise the VMA by installing the default kernel mapping.
 	_vma.install_default_kernel_mapping();
 
 	// Create the main thread.
-	_main_thread = &create_thread(kernel_process ? ThreadPrivilege::Kernel : ThreadPrivilege::User, entry_point, "main");
+	_main_thread = &create_thread(kernel_process ? ThreadPrivilege::Kernel : ThreadPrivilege::User, entry_point, "main", priority);
 }
 
 Process::~Process()
@@ -31,6 +46,23 @@ Process::~Process()
 	}
 }
 
+/**
+ * Allocates a process object from the process cache.
+ */
+void *Process::operator new(size_t size)
+{
+	assert(size == sizeof(Process));
+	return process_cache.alloc();
+}
+
+/**
+ * Returns a process object to the process cache.
+ */
+void Process::operator delete(void *p)
+{
+	process_cache.free(p);
+}
+
 void Process::start()
 {
 	// Start the main thread.
@@ -39,12 +71,91 @@ void Process::start()
 
 void Process::terminate(int rc)
 {
+	// Interrupts stay disabled until the current thread (if it belongs to this process) has
+	// stopped, so that the reaper cannot run while it is still using its kernel stack.
+	UniqueIRQLock l;
+
+	if (_terminated) return;
+
 	_terminated = true;
 	_state_changed.trigger();
 
+	if (!_kernel_process && reaper_thread) {
+		reap_queue.append(*this);
+		reaper_thread->wake_up();
+	}
+
+	Thread *current = NULL;
 	for (const auto& thread : _threads) {
-		thread->stop();
+		if (thread == &Thread::current()) {
+			current = thread;
+		} else {
+			thread->stop();
+		}
 	}
+
+	// Stopping the current thread does not return, so it is stopped last.
+	if (current) {
+		current->stop();
+	}
+}
+
+/**
+ * Gives back the memory of a terminated process: its user pages, page tables and the kernel
+ * stacks of its threads.  A thread of the process may have been stopped while it held the
+ * lock of the address space, e.g. while populating a page from a file, so the reaper does not
+ * wait for the lock.
+ * @return Returns false if the address space was busy, and must be reaped again later.
+ */
+bool Process::reap()
+{
+	for (const auto& thread : _threads) {
+		assert(thread->state() == SchedulingEntityState::STOPPED);
+	}
+
+	return _vma.try_release();
+}
+
+void Process::reaper_threadproc()
+{
+	for (;;) {
+		Process *p;
+
+		{
+			UniqueIRQLock l;
+
+			// Sleeping with interrupts disabled means that a process cannot be queued between
+			// finding the queue empty and going to sleep.
+			p = reap_queue.pop_front();
+			if (!p) {
+				Thread::current().sleep();
+
+				// Processes that were busy last time are given another chance, now that
+				// something else has happened.
+				while (Process *busy = busy_reap_queue.pop_front()) {
+					reap_queue.append(*busy);
+				}
+
+				continue;
+			}
+		}
+
+		if (!p->reap()) {
+			busy_reap_queue.append(*p);
+		}
+	}
+}
+
+/**
+ * Starts the background thread that tears down the address spaces of terminated processes.
+ * This must be called once the scheduler is running.
+ */
+void Process::start_reaper()
+{
+	Process *reaper_process = new Process("reaper", true, (Thread::thread_proc_t)&reaper_threadproc, SchedulingEntityPriority::DAEMON);
+
+	reaper_thread = &reaper_process->main_thread();
+	reaper_process->start();
 }
 
 Thread& Process::create_thread(ThreadPrivilege::ThreadPrivilege privilege, Thread::thread_proc_t entry_point,
@@ -12,7 +12,7 @@
 #include <infos/kernel/sched.h>
 #include <infos/kernel/thread.h>
 #include <infos/kernel/log.h>
-#include <infos/util/list.h>
+#include <infos/util/intrusive-rbtree.h>
 #include <infos/util/lock.h>
 
 using namespace infos::kernel;
@@ -47,7 +47,8 @@ public:
 	{
 		UniqueIRQLock l; // IRQ refers to "Interrupt ReQuest" (or any other r?)
 		// Is the lock used though? Only a declaration here
-		runqueue.enqueue(&entity);
+		entity.runqueue_key(entity.cpu_runtime());
+		runqueue.insert(entity);
 	}
 
 	/**
@@ -57,7 +58,11 @@ public:
 	void remove_from_runqueue(SchedulingEntity& entity) override
 	{
 		UniqueIRQLock l;
-		runqueue.remove(&entity);
+		runqueue.remove(entity);
+
+		if (&entity == last_picked) {
+			last_picked = NULL;
+		}
 	}
 
 	/**
@@ -66,24 +71,37 @@ public:
 	 * e.g. its timeslice has not expired.
 	 */
 	SchedulingEntity *pick_next_entity() override
-	{	
+	{
 		if (runqueue.count() == 0) return NULL;
-		if (runqueue.count() == 1) return runqueue.first();
-		
-		SchedulingEntity::EntityRuntime min_runtime = 0;
-		SchedulingEntity *min_runtime_entity = NULL;
-		for (const auto& entity : runqueue) {
-			if (min_runtime_entity == NULL || entity->cpu_runtime() < min_runtime) {
-				min_runtime_entity = entity;
-				min_runtime = entity->cpu_runtime();
-			}
+
+		// The entity that was picked last time has been running since, so it is re-queued
+		// under its new runtime.  Every other entity's runtime is unchanged since it was
+		// queued.
+		if (last_picked) {
+			runqueue.remove(*last_picked);
+			last_picked->runqueue_key(last_picked->cpu_runtime());
+			runqueue.insert(*last_picked);
 		}
-				
-		return min_runtime_entity;
+
+		last_picked = runqueue.first();
+		return last_picked;
 	}
-	
+
 private:
-	List<SchedulingEntity *> runqueue;
+	/**
+	 * Orders entities by their runtime when they were queued, so that the entity that has
+	 * had the least CPU time is leftmost.
+	 */
+	struct RuntimeOrder
+	{
+		bool operator()(const SchedulingEntity& a, const SchedulingEntity& b) const
+		{
+			return a.runqueue_key() < b.runqueue_key();
+		}
+	};
+
+	IntrusiveRBTree<SchedulingEntity, RuntimeOrder> runqueue;
+	SchedulingEntity *last_picked = NULL;
 };
 
 /* --- DO NOT CHANGE ANYTHING BELOW THIS LINE --- */
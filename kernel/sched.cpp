@@ -42,11 +42,15 @@ Scheduler::Scheduler(Kernel& owner) : Subsystem(owner), _active(false), _current
 }
 
 /**
- * The idle task thread proc.  It just spins in a loop, relaxing the processor.
+ * The idle task thread proc.  It just spins in a loop, relaxing the processor, and giving
+ * the memory manager a chance to schedule background work.
  */
 static void idle_task()
 {
-	for (;;) asm volatile("pause");
+	for (;;) {
+		sys.mm().idle();
+		asm volatile("pause");
+	}
 }
 
 bool Scheduler::init()
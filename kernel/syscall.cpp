@@ -111,6 +111,7 @@ unsigned int DefaultSyscalls::sys_close(ObjectHandle h)
 	}
 
 	f->close();
+	sys.object_manager().unregister_object(Thread::current(), h);
 	return 0;
 }
 
@@ -174,6 +175,7 @@ unsigned int DefaultSyscalls::sys_closedir(ObjectHandle h)
 	}
 
 	d->close();
+	sys.object_manager().unregister_object(Thread::current(), h);
 	return 0;
 }
 
@@ -240,11 +242,12 @@ ObjectHandle DefaultSyscalls::sys_create_thread(uintptr_t entry_point, uintptr_t
 	Thread& t = Thread::current().owner().create_thread(ThreadPrivilege::User, (Thread::thread_proc_t)entry_point, "other", priority);
 	ObjectHandle h = sys.object_manager().register_object(Thread::current(), &t);
 
-	virt_addr_t stack_addr = 0x7fff00000000;
-	stack_addr += 0x2000 * (unsigned int) h;
+	if (!t.allocate_user_stack(0x2000)) {
+		// The thread is never started, so it is left for the process to clean up.
+		sys.object_manager().unregister_object(Thread::current(), h);
+		return (ObjectHandle)-1;
+	}
 
-	t.allocate_user_stack(stack_addr, 0x2000);
-	//t.owner().vma().allocate_virt()
 	t.add_entry_argument((void *) arg);
 	t.start();
 
@@ -13,8 +13,10 @@
 #include <infos/kernel/kernel.h>
 #include <infos/mm/mm.h>
 #include <infos/mm/page-allocator.h>
+#include <infos/mm/object-cache.h>
 #include <infos/kernel/log.h>
 #include <infos/util/string.h>
+#include <infos/util/lock.h>
 #include <arch/arch.h>
 
 using namespace infos::kernel;
@@ -23,6 +25,8 @@ using namespace infos::util;
 #define KERNEL_STACK_ORDER		1
 #define KERNEL_STACK_SIZE		((1 << KERNEL_STACK_ORDER) * __page_size)
 
+static infos::mm::ObjectCache thread_cache("thread", sizeof(Thread));
+
 /**
  * Constructs a new thread object.
  */
@@ -64,7 +68,24 @@ Thread::Thread(Process& owner, ThreadPrivilege::ThreadPrivilege privilege, threa
  */
 Thread::~Thread()
 {
-	// The VMA will release allocated memory (hopefully)
+	// The kernel stack was allocated from the owner's VMA, and is released along with it.
+}
+
+/**
+ * Allocates a thread object from the thread cache.
+ */
+void *Thread::operator new(size_t size)
+{
+	assert(size == sizeof(Thread));
+	return thread_cache.alloc();
+}
+
+/**
+ * Returns a thread object to the thread cache.
+ */
+void Thread::operator delete(void *p)
+{
+	thread_cache.free(p);
 }
 
 void Thread::add_entry_argument(void* arg)
@@ -125,6 +146,12 @@ void Thread::sleep()
 
 void Thread::wake_up()
 {
+	util::UniqueIRQLock l;
+
+	// A thread that was stopped while it was asleep, e.g. because its process terminated,
+	// stays stopped.
+	if (state() != SchedulingEntityState::SLEEPING) return;
+
 	sys.scheduler().set_entity_state(*this, SchedulingEntityState::RUNNABLE);
 }
 
@@ -146,12 +173,19 @@ bool Thread::activate(SchedulingEntity *prev)
 	return true;
 }
 
-void Thread::allocate_user_stack(virt_addr_t vaddr, size_t size)
+/**
+ * Reserves a user stack for the thread, wherever there is room in its process's address
+ * space, and points the thread's stack pointer at the top of it.
+ * @return Returns false if the stack could not be reserved.
+ */
+bool Thread::allocate_user_stack(size_t size)
 {
-	int nr_pages = __align_up_page(size) >> 12;
+	// Stack pages are only allocated as the stack grows into them.
+	virt_addr_t vaddr;
+	if (!_owner.vma().allocate_virt_any(__align_up_page(size) >> __page_bits, vaddr)) return false;
 
-	_owner.vma().allocate_virt(vaddr, nr_pages);
 	_context.native_context->rsp = vaddr + size - 8;
+	return true;
 }
 
 Thread& Thread::current()
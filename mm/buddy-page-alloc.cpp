@@ -0,0 +1,339 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/buddy-page-alloc.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+
+using namespace infos::kernel;
+using namespace infos::mm;
+
+#define MAX_ORDER	17
+
+// Merging a block of the largest order never looks beyond its own naturally aligned
+// 2^(MAX_ORDER - 1) pages, which must not span a deferred-initialisation section.
+static_assert((MAX_ORDER - 1) <= PGALLOC_SECTION_ORDER, "buddy blocks must not span page allocator sections");
+
+/**
+ * A power-of-two buddy page allocation algorithm.  Free blocks of 2^order pages
+ * are kept on per-order doubly-linked free lists, threaded through the free-list
+ * links of the first page descriptor in each block.  The head descriptor of every
+ * free block is tagged with FREE_BLOCK_HEAD and its order, so that the buddy of a
+ * block being freed can be checked in constant time.
+ */
+class BuddyPageAllocator : public PageAllocatorAlgorithm
+{
+private:
+	PageDescriptor *_pgd_base;
+	uint64_t _nr_pgds;
+
+	PageDescriptor *_free_areas[MAX_ORDER];
+	PageDescriptor *_free_area_tails[MAX_ORDER];
+
+	/**
+	 * Returns the PFN of the given page descriptor.
+	 */
+	inline pfn_t pgd_to_pfn(const PageDescriptor *pgd) const
+	{
+		return (pfn_t)(pgd - _pgd_base);
+	}
+
+	/**
+	 * Returns true if the given page descriptor heads a free block of the given order.
+	 */
+	inline bool is_free_block(const PageDescriptor *pgd, int order) const
+	{
+		return (pgd->flags & PageDescriptorFlags::FREE_BLOCK_HEAD) && pgd->order == order;
+	}
+
+	/**
+	 * Links a block into the free list for the given order.  Blocks can either be
+	 * placed at the front of the list, where they will be the next to be allocated,
+	 * or at the back.
+	 */
+	void link_block(PageDescriptor *pgd, int order, bool at_front)
+	{
+		assert(!(pgd->flags & PageDescriptorFlags::FREE_BLOCK_HEAD));
+
+		pgd->flags |= PageDescriptorFlags::FREE_BLOCK_HEAD;
+		pgd->order = order;
+
+		if (at_front || !_free_areas[order]) {
+			pgd->prev_free(NULL);
+			pgd->next_free(_free_areas[order]);
+
+			if (_free_areas[order]) {
+				_free_areas[order]->prev_free(pgd);
+			} else {
+				_free_area_tails[order] = pgd;
+			}
+
+			_free_areas[order] = pgd;
+		} else {
+			pgd->next_free(NULL);
+			pgd->prev_free(_free_area_tails[order]);
+
+			_free_area_tails[order]->next_free(pgd);
+			_free_area_tails[order] = pgd;
+		}
+	}
+
+	/**
+	 * Removes a block from the free list for the given order.
+	 */
+	void unlink_block(PageDescriptor *pgd, int order)
+	{
+		assert(is_free_block(pgd, order));
+
+		PageDescriptor *prev = pgd->prev_free();
+		PageDescriptor *next = pgd->next_free();
+
+		if (prev) {
+			prev->next_free(next);
+		} else {
+			_free_areas[order] = next;
+		}
+
+		if (next) {
+			next->prev_free(prev);
+		} else {
+			_free_area_tails[order] = prev;
+		}
+
+		pgd->next_free(NULL);
+		pgd->prev_free(NULL);
+		pgd->flags &= ~PageDescriptorFlags::FREE_BLOCK_HEAD;
+	}
+
+	/**
+	 * Returns the largest order of block that can start at the given PFN, and that
+	 * fits within the given number of pages.
+	 */
+	static int largest_fitting_order(pfn_t pfn, uint64_t count)
+	{
+		int order = 0;
+		while (order < (MAX_ORDER - 1)) {
+			uint64_t size = 1ull << (order + 1);
+			if ((pfn & (size - 1)) != 0 || size > count) break;
+
+			order++;
+		}
+
+		return order;
+	}
+
+	/**
+	 * Frees a block of pages, merging it with its buddies where possible.
+	 */
+	void free_block(PageDescriptor *pgd, int order, bool at_front)
+	{
+		pfn_t pfn = pgd_to_pfn(pgd);
+
+		while (order < (MAX_ORDER - 1)) {
+			pfn_t buddy_pfn = pfn ^ (1ull << order);
+			if (buddy_pfn >= _nr_pgds) break;
+
+			PageDescriptor *buddy = &_pgd_base[buddy_pfn];
+			if (!is_free_block(buddy, order)) break;
+
+			unlink_block(buddy, order);
+
+			pfn &= ~(1ull << order);
+			order++;
+		}
+
+		link_block(&_pgd_base[pfn], order, at_front);
+	}
+
+	/**
+	 * Inserts an arbitrary range of pages into the free lists, without merging, by
+	 * breaking it up into the largest naturally aligned blocks that fit.
+	 */
+	void insert_unmerged_range(pfn_t pfn, uint64_t count)
+	{
+		while (count > 0) {
+			int order = largest_fitting_order(pfn, count);
+			link_block(&_pgd_base[pfn], order, true);
+
+			pfn += 1ull << order;
+			count -= 1ull << order;
+		}
+	}
+
+	/**
+	 * Finds the free block that contains the given PFN, if any.
+	 */
+	PageDescriptor *find_containing_block(pfn_t pfn, int& order) const
+	{
+		for (int o = 0; o < MAX_ORDER; o++) {
+			pfn_t head = pfn & ~((1ull << o) - 1);
+
+			if (is_free_block(&_pgd_base[head], o)) {
+				order = o;
+				return &_pgd_base[head];
+			}
+		}
+
+		return NULL;
+	}
+
+public:
+	bool init(PageDescriptor *page_descriptors, uint64_t nr_page_descriptors) override
+	{
+		mm_log.messagef(LogLevel::DEBUG, "Buddy Page Allocator online");
+		_pgd_base = page_descriptors;
+		_nr_pgds = nr_page_descriptors;
+
+		for (int i = 0; i < MAX_ORDER; i++) {
+			_free_areas[i] = NULL;
+			_free_area_tails[i] = NULL;
+		}
+
+		return true;
+	}
+
+	PageDescriptor *allocate_pages(int order) override
+	{
+		if (order < 0 || order >= MAX_ORDER) return NULL;
+
+		// Find the smallest non-empty free area that can satisfy the request.
+		int source_order = order;
+		while (source_order < MAX_ORDER && !_free_areas[source_order]) {
+			source_order++;
+		}
+
+		if (source_order == MAX_ORDER) return NULL;
+
+		PageDescriptor *block = _free_areas[source_order];
+		unlink_block(block, source_order);
+
+		// Split the block down to the requested size, returning the upper halves
+		// to the free lists.
+		while (source_order > order) {
+			source_order--;
+			link_block(block + (1ull << source_order), source_order, true);
+		}
+
+		return block;
+	}
+
+	unsigned int allocate_pages_bulk(unsigned int nr_pages, PageDescriptor **pgds) override
+	{
+		unsigned int nr_allocated = 0;
+
+		while (nr_allocated < nr_pages) {
+			// Find the smallest non-empty free area, so that fragments are used up first.
+			int order = 0;
+			while (order < MAX_ORDER && !_free_areas[order]) {
+				order++;
+			}
+
+			if (order == MAX_ORDER) break;
+
+			PageDescriptor *block = _free_areas[order];
+			unlink_block(block, order);
+
+			// Hand out as many pages of the block as are needed, and give back the rest
+			// without splitting it down one order at a time.
+			uint64_t block_size = 1ull << order;
+			uint64_t nr_taken = __min(block_size, nr_pages - nr_allocated);
+
+			for (uint64_t i = 0; i < nr_taken; i++) {
+				pgds[nr_allocated++] = block + i;
+			}
+
+			if (nr_taken < block_size) {
+				insert_unmerged_range(pgd_to_pfn(block) + nr_taken, block_size - nr_taken);
+			}
+		}
+
+		return nr_allocated;
+	}
+
+	void free_pages(PageDescriptor *pgd, int order) override
+	{
+		assert(order >= 0 && order < MAX_ORDER);
+		assert((pgd_to_pfn(pgd) & ((1ull << order) - 1)) == 0);
+
+		free_block(pgd, order, true);
+	}
+
+	void insert_page_range(PageDescriptor *start, uint64_t count) override
+	{
+		mm_log.messagef(LogLevel::DEBUG, "Inserting available page range from %lx -- %lx", pgd_to_pfn(start), pgd_to_pfn(start + count));
+
+		// Newly inserted memory goes to the back of the free lists, so that memory
+		// inserted earlier (i.e. lower physical memory) is preferred.
+		pfn_t pfn = pgd_to_pfn(start);
+		while (count > 0) {
+			int order = largest_fitting_order(pfn, count);
+			free_block(&_pgd_base[pfn], order, false);
+
+			pfn += 1ull << order;
+			count -= 1ull << order;
+		}
+	}
+
+	void remove_page_range(PageDescriptor *start, uint64_t count) override
+	{
+		mm_log.messagef(LogLevel::DEBUG, "Removing available page range from %lx -- %lx", pgd_to_pfn(start), pgd_to_pfn(start + count));
+
+		pfn_t pfn = pgd_to_pfn(start);
+		pfn_t end = pfn + count;
+
+		while (pfn < end) {
+			int order;
+			PageDescriptor *block = find_containing_block(pfn, order);
+
+			if (!block) {
+				// This page is not free, so there is nothing to remove.
+				pfn++;
+				continue;
+			}
+
+			// Take the whole block off the free list, and give back the parts of it
+			// that lie outside of the range being removed.
+			unlink_block(block, order);
+
+			pfn_t block_start = pgd_to_pfn(block);
+			pfn_t block_end = block_start + (1ull << order);
+
+			if (block_start < pfn) {
+				insert_unmerged_range(block_start, pfn - block_start);
+			}
+
+			if (block_end > end) {
+				insert_unmerged_range(end, block_end - end);
+				block_end = end;
+			}
+
+			pfn = block_end;
+		}
+	}
+
+	const char *name() const override { return "buddy"; }
+
+	void dump_state() const override
+	{
+		mm_log.messagef(LogLevel::DEBUG, "BUDDY STATE:");
+
+		for (int i = 0; i < MAX_ORDER; i++) {
+			unsigned int nr_blocks = 0;
+			for (PageDescriptor *pgd = _free_areas[i]; pgd; pgd = pgd->next_free()) {
+				nr_blocks++;
+			}
+
+			if (nr_blocks == 0) continue;
+
+			mm_log.messagef(LogLevel::DEBUG, "[%d] %u block(s), first=%lx", i, nr_blocks, pgd_to_pfn(_free_areas[i]));
+		}
+	}
+};
+
+RegisterPageAllocator(BuddyPageAllocator);
@@ -539,22 +539,27 @@ MAX_RELEASE_CHECK_RATE   default: 4095 unless not HAVE_MMAP
 #define HAVE_MORECORE 0
 #define HAVE_MREMAP 0
 
+// Memory comes straight from the page allocator, which does not zero it.
+#define MMAP_CLEARS 0
+
+// Allocations of 64K and above are served directly as runs of pages, and given back to
+// the page allocator as soon as they are freed.  Free memory at the top of the heap is
+// given back once there is more than 256K of it.
+#define DEFAULT_MMAP_THRESHOLD ((size_t)64U * (size_t)1024U)
+#define DEFAULT_TRIM_THRESHOLD ((size_t)256U * (size_t)1024U)
+
 #define PROT_READ	1
 #define PROT_WRITE	2
 
 #define MAP_PRIVATE 1
 #define MAP_ANONYMOUS 2
 
+#define MAP_FAILED ((void *)~(size_t)0)
+
 static inline void *mmap(void *addr, size_t size, int flags, int prot, int fd, int off)
 {
-	assert((size % 4096) == 0);
-	
-	unsigned int pages = size >> 12;
-	unsigned int order = infos::util::ilog2_ceil(pages);
-	
-	const infos::mm::PageDescriptor *pgd = infos::kernel::sys.mm().pgalloc().alloc_pages(order);
-	
-	return (void *)infos::kernel::sys.mm().pgalloc().pgd_to_vpa(pgd);
+	void *ptr = infos::kernel::sys.mm().objalloc().map_heap_pages(size);
+	return ptr ? ptr : MAP_FAILED;
 }
 
 static inline void *mremap(void *addr, size_t old_size, size_t new_size, int flags)
@@ -565,14 +570,7 @@ static inline void *mremap(void *addr, size_t old_size, size_t new_size, int fla
 
 static inline int munmap(void *addr, size_t size)
 {
-	assert((size % 4096) == 0);
-	
-	infos::mm::PageDescriptor *pgd = infos::kernel::sys.mm().pgalloc().vpa_to_pgd((virt_addr_t)addr);
-	assert(pgd);
-
-	unsigned int pages = size >> 12;
-	unsigned int order = infos::util::ilog2_floor(pages);
-	infos::kernel::sys.mm().pgalloc().free_pages(pgd, order);
+	infos::kernel::sys.mm().objalloc().unmap_heap_pages(addr, size);
 	return 0;
 }
 
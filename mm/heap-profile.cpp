@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/heap-profile.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/heap-profile.h>
+#include <infos/mm/object-allocator.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/fs/file.h>
+#include <infos/util/printf.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
+#include <infos/util/cmdline.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::drivers;
+using namespace infos::fs;
+using namespace infos::util;
+
+// Call sites are looked up in each CPU's table by hashing their address, and probing at
+// most this many slots.
+#define HEAPPROF_MAX_PROBES		8
+
+// The number of call sites that are included in a dump.
+#define HEAPPROF_DUMP_CALL_SITES	32
+
+// The size of the buffer that the profile is formatted into.
+#define HEAPPROF_DUMP_SIZE		8192
+
+HeapProfile infos::mm::heap_profile;
+
+const DeviceClass HeapProfileDevice::HeapProfileDeviceClass(Device::RootDeviceClass, "heapprof");
+
+RegisterCmdLineArgument(ObjAllocProfile, "objalloc.profile")
+{
+	if (strncmp(value, "1", 1) == 0) {
+		heap_profile.enable();
+	}
+}
+
+HeapProfile::HeapProfile() : _enabled(false), _peak_live_bytes(0)
+{
+	bzero(_cpus, sizeof(_cpus));
+}
+
+/**
+ * Records an allocation.
+ * @param caller The return address of the allocating call
+ * @param bucket The size class of the allocation, or OBJALLOC_NR_SIZE_CLASSES if it is
+ * too large for any class
+ * @param size The number of bytes that the allocation really occupies
+ */
+void HeapProfile::record_alloc(const void *caller, int bucket, size_t size)
+{
+	UniqueIRQLock l;
+
+	PerCPUHeapProfile& cpu = _cpus[CPU::current().id()];
+
+	cpu.live_objects[bucket]++;
+	cpu.live_bytes[bucket] += size;
+	cpu.total_live_bytes += size;
+	cpu.nr_allocs++;
+
+	int64_t total_live_bytes = 0;
+	for (unsigned int i = 0; i < MAX_CPUS; i++) {
+		total_live_bytes += _cpus[i].total_live_bytes;
+	}
+
+	_peak_live_bytes = __max(_peak_live_bytes, total_live_bytes);
+
+	unsigned int slot = (((uintptr_t)caller * 0x9e3779b97f4a7c15ull) >> 32) % HEAPPROF_NR_CALL_SITES;
+	for (unsigned int probe = 0; probe < HEAPPROF_MAX_PROBES; probe++) {
+		HeapProfileCallSite& site = cpu.call_sites[(slot + probe) % HEAPPROF_NR_CALL_SITES];
+
+		if (site.caller == caller || site.caller == NULL) {
+			site.caller = caller;
+			site.nr_allocs++;
+			site.nr_bytes += size;
+			return;
+		}
+	}
+
+	cpu.nr_unattributed++;
+}
+
+/**
+ * Records a free.
+ * @param bucket The size class of the object, as for record_alloc
+ * @param size The number of bytes that the object really occupies
+ */
+void HeapProfile::record_free(int bucket, size_t size)
+{
+	UniqueIRQLock l;
+
+	PerCPUHeapProfile& cpu = _cpus[CPU::current().id()];
+
+	cpu.live_objects[bucket]--;
+	cpu.live_bytes[bucket] -= size;
+	cpu.total_live_bytes -= size;
+	cpu.nr_frees++;
+}
+
+/**
+ * Formats the profile as text, one key=value record per line.  The counters are read
+ * without stopping other CPUs, so the totals may be slightly out of step with each other.
+ * @param buffer The buffer to format the profile into
+ * @param size The size of the buffer
+ * @return Returns the length of the formatted profile.
+ */
+int HeapProfile::format(char *buffer, int size) const
+{
+	int len = 0;
+
+	if (!_enabled) {
+		return snprintf(buffer, size, "heap profiling is disabled (boot with objalloc.profile=1)\n");
+	}
+
+	int64_t live_objects[HEAPPROF_NR_BUCKETS], live_bytes[HEAPPROF_NR_BUCKETS];
+	int64_t total_live_bytes = 0;
+	uint64_t nr_allocs = 0, nr_frees = 0, nr_unattributed = 0;
+
+	bzero(live_objects, sizeof(live_objects));
+	bzero(live_bytes, sizeof(live_bytes));
+
+	for (unsigned int i = 0; i < MAX_CPUS; i++) {
+		const PerCPUHeapProfile& cpu = _cpus[i];
+
+		for (int bucket = 0; bucket < HEAPPROF_NR_BUCKETS; bucket++) {
+			live_objects[bucket] += cpu.live_objects[bucket];
+			live_bytes[bucket] += cpu.live_bytes[bucket];
+		}
+
+		total_live_bytes += cpu.total_live_bytes;
+		nr_allocs += cpu.nr_allocs;
+		nr_frees += cpu.nr_frees;
+		nr_unattributed += cpu.nr_unattributed;
+	}
+
+	len += snprintf(&buffer[len], size - len, "HEAPPROF allocs=%lu frees=%lu live_bytes=%ld peak_live_bytes=%ld unattributed=%lu\n",
+		nr_allocs, nr_frees, total_live_bytes, _peak_live_bytes, nr_unattributed);
+
+	for (int bucket = 0; bucket < HEAPPROF_NR_BUCKETS; bucket++) {
+		if (bucket < OBJALLOC_NR_SIZE_CLASSES) {
+			len += snprintf(&buffer[len], size - len, "HEAPPROF class=%lu live_objects=%ld live_bytes=%ld\n",
+				ObjectAllocator::size_class_size(bucket), live_objects[bucket], live_bytes[bucket]);
+		} else {
+			len += snprintf(&buffer[len], size - len, "HEAPPROF class=large live_objects=%ld live_bytes=%ld\n",
+				live_objects[bucket], live_bytes[bucket]);
+		}
+	}
+
+	// Report the call sites that have allocated the most bytes.  A call site may appear in
+	// every CPU's table, so its counts are merged before it is reported.
+	const void *reported[HEAPPROF_DUMP_CALL_SITES];
+	unsigned int nr_reported = 0;
+
+	while (nr_reported < HEAPPROF_DUMP_CALL_SITES) {
+		const void *best = NULL;
+		uint64_t best_bytes = 0;
+
+		for (unsigned int i = 0; i < MAX_CPUS; i++) {
+			for (unsigned int slot = 0; slot < HEAPPROF_NR_CALL_SITES; slot++) {
+				const HeapProfileCallSite& site = _cpus[i].call_sites[slot];
+				if (!site.caller || site.nr_bytes <= best_bytes) continue;
+
+				bool seen = false;
+				for (unsigned int r = 0; r < nr_reported; r++) {
+					if (reported[r] == site.caller) {
+						seen = true;
+						break;
+					}
+				}
+
+				if (!seen) {
+					best = site.caller;
+					best_bytes = site.nr_bytes;
+				}
+			}
+		}
+
+		if (!best) break;
+
+		uint64_t site_allocs = 0, site_bytes = 0;
+		for (unsigned int i = 0; i < MAX_CPUS; i++) {
+			for (unsigned int slot = 0; slot < HEAPPROF_NR_CALL_SITES; slot++) {
+				const HeapProfileCallSite& site = _cpus[i].call_sites[slot];
+
+				if (site.caller == best) {
+					site_allocs += site.nr_allocs;
+					site_bytes += site.nr_bytes;
+				}
+			}
+		}
+
+		len += snprintf(&buffer[len], size - len, "HEAPPROF site=%p allocs=%lu bytes=%lu\n", best, site_allocs, site_bytes);
+		reported[nr_reported++] = best;
+	}
+
+	return len;
+}
+
+/**
+ * A snapshot of the heap profile, taken when the file is opened.
+ */
+class HeapProfileFile : public File
+{
+public:
+	HeapProfileFile() : _pos(0)
+	{
+		_buffer = new char[HEAPPROF_DUMP_SIZE];
+		_length = _buffer ? heap_profile.format(_buffer, HEAPPROF_DUMP_SIZE) : 0;
+	}
+
+	~HeapProfileFile()
+	{
+		delete[] _buffer;
+	}
+
+	int pread(void *buffer, size_t size, off_t off) override
+	{
+		if (off >= (off_t)_length) {
+			return 0;
+		}
+
+		size_t count = __min(size, (size_t)(_length - off));
+		memcpy(buffer, &_buffer[off], count);
+
+		return count;
+	}
+
+	int read(void *buffer, size_t size) override
+	{
+		int count = pread(buffer, size, _pos);
+		_pos += count;
+
+		return count;
+	}
+
+private:
+	char *_buffer;
+	int _length;
+	off_t _pos;
+};
+
+File *HeapProfileDevice::open_as_file()
+{
+	return new HeapProfileFile();
+}
+
+RegisterDevice(HeapProfileDevice);
@@ -158,6 +158,28 @@ bool MemoryManager::initialise_allocators()
 	return true;
 }
 
+/**
+ * Starts the memory manager's background kernel threads.  This must be called once
+ * the scheduler is running.
+ */
+void MemoryManager::start_background_threads()
+{
+	_page_alloc.start_deferred_init();
+	_page_alloc.start_zeroing_thread();
+	_page_alloc.start_compaction_thread();
+	_obj_alloc.start_maintenance_thread();
+}
+
+/**
+ * Performs background memory management work.  This is called from the idle task, when
+ * there is nothing else for the CPU to do.
+ */
+void MemoryManager::idle()
+{
+	_page_alloc.idle();
+	_obj_alloc.idle();
+}
+
 const PhysicalMemoryBlock *MemoryManager::lookup_phys_block(phys_addr_t addr)
 {
 	// Iterate over each physical memory block, and return the descriptor
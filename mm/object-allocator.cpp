@@ -10,6 +10,11 @@
  */
 #include <infos/mm/object-allocator.h>
 #include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/heap-profile.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/cpu.h>
+#include <infos/kernel/process.h>
 #include <infos/util/lock.h>
 #include <infos/util/cmdline.h>
 #include <infos/util/string.h>
@@ -20,6 +25,28 @@ using namespace infos::util;
 
 ComponentLog infos::mm::objalloc_log(syslog, "objalloc");
 
+// The depot holds at most this many full and empty magazines per size class.  Beyond that,
+// full magazines are flushed back to the heap, and empty magazines are freed.
+#define DEPOT_MAX_FULL		16
+#define DEPOT_MAX_EMPTY		16
+
+// When the CPU is idle, the depot is trimmed down to this many magazines per size class.
+#define DEPOT_IDLE_FULL		2
+#define DEPOT_IDLE_EMPTY	2
+
+// How often, in nanoseconds, the maintenance thread is woken to flush the magazines back to
+// the depot, and trim the heap.
+#define MAGAZINE_FLUSH_INTERVAL	1000000000ull
+
+// The size classes that are cached in magazines.  Smaller requests are rounded up to the
+// nearest class.
+static const size_t size_classes[OBJALLOC_NR_SIZE_CLASSES] = { 16, 32, 48, 64, 96, 128, 192, 256, 384, 512 };
+
+static bool magazines_enabled = true;
+
+// The heap aligns every allocation to at least this boundary.
+#define OBJALLOC_MIN_ALIGN	16ul
+
 RegisterCmdLineArgument(ObjAllocDebug, "objalloc.debug") {
 	if (strncmp(value, "1", 1) == 0) {
 		objalloc_log.enable();
@@ -28,32 +55,671 @@ RegisterCmdLineArgument(ObjAllocDebug, "objalloc.debug") {
 	}
 }
 
-ObjectAllocator::ObjectAllocator(MemoryManager& mm) : Allocator(mm)
+RegisterCmdLineArgument(ObjAllocMagazines, "objalloc.magazines") {
+	magazines_enabled = strncmp(value, "1", 1) == 0;
+}
+
+ObjectAllocator::ObjectAllocator(MemoryManager& mm)
+	: Allocator(mm),
+	  _heap_stats(),
+	  _heap_flags(AllocFlags::NONE),
+	  _magazines_enabled(false),
+	  _maintenance_thread(NULL),
+	  _last_flush(0),
+	  _nr_magazine_hits(0),
+	  _nr_magazine_misses(0)
 {
 }
 
 bool ObjectAllocator::init()
 {
+	bzero(_magazines, sizeof(_magazines));
+	bzero(_depots, sizeof(_depots));
+	
+	// The magazines are per-CPU, so they can only be used once the CPUs are known.
+	_magazines_enabled = magazines_enabled;
+	
+	objalloc_log.messagef(LogLevel::INFO, "Object magazines: %s", _magazines_enabled ? "enabled" : "disabled");
 	return true;
 }
 
 extern "C" void *dlmalloc(size_t size);
+extern "C" void *dlmemalign(size_t align, size_t size);
 extern "C" void dlfree(void *ptr);
+extern "C" size_t dlmalloc_usable_size(void *ptr);
+extern "C" int dlmalloc_trim(size_t pad);
+
+/**
+ * Returns the size class that an allocation of the given size is rounded up to, or -1 if
+ * it is too large to be cached.
+ */
+static inline int size_class_of(size_t size)
+{
+	for (int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		if (size <= size_classes[i]) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+/**
+ * Returns the size class that a freed object can be reused for, given its usable size, or
+ * -1 if it is too large to be cached.  The heap may hand out a little more than was asked
+ * for, so this is the largest class that the object can hold.
+ */
+static inline int size_class_of_usable(size_t usable)
+{
+	// Anything bigger than the largest class, plus the heap's rounding, would waste memory
+	// sitting in a magazine.
+	if (usable > size_classes[OBJALLOC_NR_SIZE_CLASSES - 1] + 16) {
+		return -1;
+	}
+	
+	for (int i = OBJALLOC_NR_SIZE_CLASSES - 1; i >= 0; i--) {
+		if (usable >= size_classes[i]) {
+			return i;
+		}
+	}
+	
+	return -1;
+}
+
+/**
+ * Returns the size of the objects in a size class.
+ */
+size_t ObjectAllocator::size_class_size(int size_class)
+{
+	return size_classes[size_class];
+}
 
-void *ObjectAllocator::alloc(size_t size, AllocFlags::AllocFlags flags)
+/**
+ * Records an allocation in the heap profile.  The profile counts the memory that an object
+ * really occupies in the heap, so that allocations and frees always balance.
+ */
+static inline void profile_alloc(void *ptr, const void *caller)
+{
+	size_t usable = dlmalloc_usable_size(ptr);
+	int size_class = size_class_of_usable(usable);
+	
+	heap_profile.record_alloc(caller, size_class >= 0 ? size_class : OBJALLOC_NR_SIZE_CLASSES, usable);
+}
+
+/**
+ * Records a free in the heap profile.
+ */
+static inline void profile_free(void *ptr)
+{
+	size_t usable = dlmalloc_usable_size(ptr);
+	int size_class = size_class_of_usable(usable);
+	
+	heap_profile.record_free(size_class >= 0 ? size_class : OBJALLOC_NR_SIZE_CLASSES, usable);
+}
+
+/**
+ * Returns the magazines belonging to the current CPU.
+ */
+PerCPUMagazines& ObjectAllocator::this_cpu_magazines()
+{
+	return _magazines[CPU::current().id()];
+}
+
+/**
+ * Allocates memory from the heap itself.  With AllocFlags::NOWAIT, nothing is allocated if
+ * the heap is busy.
+ */
+void *ObjectAllocator::heap_alloc(size_t size, size_t align, AllocFlags::AllocFlags flags)
+{
+	if (flags & AllocFlags::NOWAIT) {
+		if (!_mtx.try_lock()) {
+			return NULL;
+		}
+	} else {
+		_mtx.lock();
+	}
+	
+	// The heap calls back into map_heap_pages with the lock held, so the flags are passed
+	// down to the page allocator from there.
+	_heap_flags = flags;
+	
+	void *ptr = align > OBJALLOC_MIN_ALIGN ? dlmemalign(align, size) : dlmalloc(size);
+	
+	_heap_flags = AllocFlags::NONE;
+	_mtx.unlock();
+	
+	return ptr;
+}
+
+void ObjectAllocator::heap_free(void *ptr)
 {
 	UniqueLock<Mutex> l(_mtx);
+	dlfree(ptr);
+}
+
+/**
+ * Allocates an object of the given size class from the current CPU's magazines, exchanging
+ * an empty magazine for a full one from the depot if necessary.  The magazines themselves
+ * are only ever touched with interrupts disabled, so the common path takes no locks.
+ * @param nowait If true, only the current CPU's magazines are used, and the depot is not
+ * touched.
+ * @return Returns the object, or NULL if there are no cached objects of this size class.
+ */
+void *ObjectAllocator::magazine_alloc(int size_class, bool nowait)
+{
+	PerCPUMagazines& cpu = this_cpu_magazines();
+	
+	{
+		UniqueIRQLock l;
+		
+		ObjectMagazine *loaded = cpu.loaded[size_class];
+		if (loaded && loaded->count > 0) {
+			_nr_magazine_hits++;
+			return loaded->objects[--loaded->count];
+		}
+		
+		ObjectMagazine *previous = cpu.previous[size_class];
+		if (previous && previous->count > 0) {
+			cpu.previous[size_class] = loaded;
+			cpu.loaded[size_class] = previous;
+			
+			_nr_magazine_hits++;
+			return previous->objects[--previous->count];
+		}
+	}
+	
+	if (nowait) {
+		return NULL;
+	}
+	
+	ObjectMagazine *full = depot_take(size_class, true);
+	if (!full) {
+		_nr_magazine_misses++;
+		return NULL;
+	}
+	
+	ObjectMagazine *old;
+	void *obj;
+	
+	{
+		UniqueIRQLock l;
+		
+		// The magazines may have changed while the depot was locked, so whichever one is
+		// displaced goes back to the depot, whatever state it is in.
+		old = cpu.previous[size_class];
+		cpu.previous[size_class] = cpu.loaded[size_class];
+		cpu.loaded[size_class] = full;
+		
+		obj = full->objects[--full->count];
+	}
+	
+	if (old) {
+		depot_put(size_class, old);
+	}
+	
+	return obj;
+}
+
+/**
+ * Frees an object into the current CPU's magazines, exchanging a full magazine for an
+ * empty one from the depot if necessary.
+ * @return Returns false if the object could not be cached, and must go back to the heap.
+ */
+bool ObjectAllocator::magazine_free(void *ptr, int size_class)
+{
+	PerCPUMagazines& cpu = this_cpu_magazines();
+	
+	{
+		UniqueIRQLock l;
+		
+		ObjectMagazine *loaded = cpu.loaded[size_class];
+		if (loaded && loaded->count < OBJALLOC_MAGAZINE_SIZE) {
+			loaded->objects[loaded->count++] = ptr;
+			return true;
+		}
+		
+		ObjectMagazine *previous = cpu.previous[size_class];
+		if (previous && previous->count < OBJALLOC_MAGAZINE_SIZE) {
+			cpu.previous[size_class] = loaded;
+			cpu.loaded[size_class] = previous;
+			
+			previous->objects[previous->count++] = ptr;
+			return true;
+		}
+	}
+	
+	ObjectMagazine *empty = depot_take(size_class, false);
+	if (!empty) {
+		return false;
+	}
+	
+	ObjectMagazine *old;
 	
-	void *ptr = dlmalloc(size);
+	{
+		UniqueIRQLock l;
+		
+		old = cpu.previous[size_class];
+		cpu.previous[size_class] = cpu.loaded[size_class];
+		cpu.loaded[size_class] = empty;
+		
+		empty->objects[empty->count++] = ptr;
+	}
+	
+	if (old) {
+		depot_put(size_class, old);
+	}
+	
+	return true;
+}
+
+/**
+ * Takes a magazine from the depot.  If an empty magazine is wanted, and the depot has
+ * none, a new one is allocated.
+ * @param full True to take a magazine holding objects, false to take an empty one
+ * @return Returns the magazine, or NULL if none is available.
+ */
+ObjectMagazine *ObjectAllocator::depot_take(int size_class, bool full)
+{
+	MagazineDepot& depot = _depots[size_class];
+	
+	{
+		UniqueLock<Mutex> l(_depot_mtx);
+		
+		ObjectMagazine *& list = full ? depot.full : depot.empty;
+		if (list) {
+			ObjectMagazine *mag = list;
+			list = mag->next;
+			
+			if (full) {
+				depot.nr_full--;
+			} else {
+				depot.nr_empty--;
+			}
+			
+			return mag;
+		}
+	}
+	
+	if (full) {
+		return NULL;
+	}
+	
+	ObjectMagazine *mag = (ObjectMagazine *)heap_alloc(sizeof(ObjectMagazine), OBJALLOC_MIN_ALIGN, AllocFlags::NONE);
+	if (mag) {
+		mag->next = NULL;
+		mag->count = 0;
+	}
+	
+	return mag;
+}
+
+/**
+ * Gives a magazine back to the depot, flushing it to the heap if the depot already holds
+ * enough full magazines.
+ */
+void ObjectAllocator::depot_put(int size_class, ObjectMagazine *mag)
+{
+	MagazineDepot& depot = _depots[size_class];
+	
+	UniqueLock<Mutex> l(_depot_mtx);
+	
+	if (mag->count > 0 && depot.nr_full >= DEPOT_MAX_FULL) {
+		UniqueLock<Mutex> heap(_mtx);
+		release_magazine_objects_locked(mag);
+	}
+	
+	if (mag->count == 0 && depot.nr_empty >= DEPOT_MAX_EMPTY) {
+		heap_free(mag);
+		return;
+	}
+	
+	depot_put_locked(size_class, mag);
+}
+
+/**
+ * Places a magazine on the appropriate depot list.  The depot lock must be held.
+ */
+void ObjectAllocator::depot_put_locked(int size_class, ObjectMagazine *mag)
+{
+	MagazineDepot& depot = _depots[size_class];
+	
+	if (mag->count > 0) {
+		mag->next = depot.full;
+		depot.full = mag;
+		depot.nr_full++;
+	} else {
+		mag->next = depot.empty;
+		depot.empty = mag;
+		depot.nr_empty++;
+	}
+}
+
+/**
+ * Returns every object in a magazine to the heap, leaving it empty.  The heap lock must
+ * be held.
+ */
+void ObjectAllocator::release_magazine_objects_locked(ObjectMagazine *mag)
+{
+	while (mag->count > 0) {
+		dlfree(mag->objects[--mag->count]);
+	}
+}
+
+/**
+ * Hands the current CPU's magazines back to the depot, and trims the depot down to a
+ * small working set, so that memory does not sit in magazines indefinitely.  Nothing is
+ * done if either lock is busy, as there will be another chance on the next flush.
+ */
+void ObjectAllocator::flush_magazines()
+{
+	if (!_depot_mtx.try_lock()) {
+		return;
+	}
+	
+	if (!_mtx.try_lock()) {
+		_depot_mtx.unlock();
+		return;
+	}
+	
+	PerCPUMagazines& cpu = this_cpu_magazines();
+	
+	for (int i = 0; i < OBJALLOC_NR_SIZE_CLASSES; i++) {
+		ObjectMagazine *loaded, *previous;
+		
+		{
+			UniqueIRQLock l;
+			
+			loaded = cpu.loaded[i];
+			previous = cpu.previous[i];
+			
+			cpu.loaded[i] = NULL;
+			cpu.previous[i] = NULL;
+		}
+		
+		if (loaded) depot_put_locked(i, loaded);
+		if (previous) depot_put_locked(i, previous);
+		
+		MagazineDepot& depot = _depots[i];
+		
+		while (depot.nr_full > DEPOT_IDLE_FULL) {
+			ObjectMagazine *mag = depot.full;
+			depot.full = mag->next;
+			depot.nr_full--;
+			
+			release_magazine_objects_locked(mag);
+			depot_put_locked(i, mag);
+		}
+		
+		while (depot.nr_empty > DEPOT_IDLE_EMPTY) {
+			ObjectMagazine *mag = depot.empty;
+			depot.empty = mag->next;
+			depot.nr_empty--;
+			
+			dlfree(mag);
+		}
+	}
+	
+	objalloc_log.messagef(LogLevel::DEBUG, "magazines flushed: hits=%lu, misses=%lu", _nr_magazine_hits, _nr_magazine_misses);
+	
+	_mtx.unlock();
+	_depot_mtx.unlock();
+}
+
+/**
+ * Takes pages from the page allocator for the heap.  This is called by the heap, with the
+ * heap lock held, both to grow the heap and to serve large allocations directly.
+ * @param size The number of bytes to map, which is a multiple of the page size
+ * @return Returns the base of the pages, or NULL if the page allocator is out of memory.
+ */
+void *ObjectAllocator::map_heap_pages(size_t size)
+{
+	assert((size % __page_size) == 0);
+	
+	uint64_t nr_pages = size / __page_size;
+	
+	PageAllocator& pgalloc = owner().pgalloc();
+	PageDescriptor *pgd = pgalloc.alloc_page_run(nr_pages, (AllocFlags::AllocFlags)(_heap_flags & AllocFlags::NOWAIT));
+	if (!pgd) {
+		objalloc_log.messagef(LogLevel::WARNING, "heap: unable to map %lu pages", nr_pages);
+		return NULL;
+	}
+	
+	_heap_stats.nr_pages += nr_pages;
+	_heap_stats.nr_pages_mapped += nr_pages;
+	_heap_stats.peak_nr_pages = __max(_heap_stats.peak_nr_pages, _heap_stats.nr_pages);
+	
+	return (void *)pgalloc.pgd_to_vpa(pgd);
+}
+
+/**
+ * Gives pages that the heap no longer needs back to the page allocator.  This is called by
+ * the heap, with the heap lock held, and may release any part of a previous mapping.
+ * @param addr The base of the pages to unmap
+ * @param size The number of bytes to unmap, which is a multiple of the page size
+ */
+void ObjectAllocator::unmap_heap_pages(void *addr, size_t size)
+{
+	assert(((uintptr_t)addr % __page_size) == 0 && (size % __page_size) == 0);
+	
+	uint64_t nr_pages = size / __page_size;
+	
+	PageAllocator& pgalloc = owner().pgalloc();
+	PageDescriptor *pgd = pgalloc.vpa_to_pgd((virt_addr_t)addr);
+	assert(pgd);
+	
+	pgalloc.free_page_run(pgd, nr_pages);
+	
+	_heap_stats.nr_pages -= nr_pages;
+	_heap_stats.nr_pages_unmapped += nr_pages;
+}
+
+/**
+ * Gives free memory at the top of the heap, and any heap segments that are completely
+ * free, back to the page allocator.  Nothing is done if the heap is busy.
+ */
+void ObjectAllocator::trim_heap()
+{
+	if (!_mtx.try_lock()) {
+		return;
+	}
+	
+	uint64_t nr_pages = _heap_stats.nr_pages;
+	
+	if (dlmalloc_trim(0)) {
+		_heap_stats.nr_trims++;
+		
+		objalloc_log.messagef(LogLevel::DEBUG, "heap: trimmed %lu pages, pages=%lu, peak=%lu",
+			nr_pages - _heap_stats.nr_pages, _heap_stats.nr_pages, _heap_stats.peak_nr_pages);
+	}
+	
+	_mtx.unlock();
+}
+
+/**
+ * The body of the maintenance thread, which flushes the magazines and trims the heap each
+ * time it is woken.  This is done in a thread of its own, rather than in the idle loop, as
+ * the idle task only runs when nothing else can: if it were preempted while holding the
+ * heap lock, the next thread to allocate would spin on the lock forever.
+ */
+void ObjectAllocator::maintenance_threadproc(ObjectAllocator *objalloc)
+{
+	for (;;)
+	{
+		if (objalloc->_magazines_enabled) {
+			objalloc->flush_magazines();
+		}
+		
+		objalloc->trim_heap();
+		
+		// Sleep until the idle loop notices that the flush interval has passed.
+		Thread::current().sleep();
+	}
+}
+
+/**
+ * Starts the background thread that flushes the magazines and trims the heap.
+ */
+void ObjectAllocator::start_maintenance_thread()
+{
+	Process *maintenance_process = new Process("objalloc", true, (Thread::thread_proc_t)&maintenance_threadproc, SchedulingEntityPriority::DAEMON);
+	maintenance_process->main_thread().add_entry_argument((void *)this);
+	
+	_last_flush = sys.runtime().time_since_epoch().count();
+	_maintenance_thread = &maintenance_process->main_thread();
+	maintenance_process->start();
+}
+
+/**
+ * Called when the CPU has nothing else to do.  Periodically wakes the maintenance thread,
+ * so that the magazines are flushed and the heap is trimmed when the CPU would otherwise
+ * be idle.
+ */
+void ObjectAllocator::idle()
+{
+	if (!_maintenance_thread || _maintenance_thread->state() != SchedulingEntityState::SLEEPING) {
+		return;
+	}
+	
+	uint64_t now = sys.runtime().time_since_epoch().count();
+	if (now - _last_flush < MAGAZINE_FLUSH_INTERVAL) {
+		return;
+	}
+	
+	_last_flush = now;
+	_maintenance_thread->wake_up();
+}
+
+/**
+ * Allocates memory for an object.  Small objects are served from the current CPU's
+ * magazines where possible.
+ * @param size The size of the object
+ * @param flags Allocation flags.  With AllocFlags::ZERO, the object is zeroed.  With
+ * AllocFlags::NOWAIT, the allocation fails rather than waiting for a lock or reclaiming
+ * memory.
+ * @param caller The call site that the allocation is attributed to in the heap profile.  By
+ * default, this is the caller of alloc.
+ * @return Returns the object, or NULL if the allocation failed.
+ */
+void *ObjectAllocator::alloc(size_t size, AllocFlags::AllocFlags flags, const void *caller)
+{
+	// Small allocations are rounded up to their size class, so that they can be reused
+	// for any object of that class once they are freed.
+	int size_class = size_class_of(size);
+	size_t alloc_size = size_class >= 0 ? size_classes[size_class] : size;
+	void *ptr = NULL;
+	
+	if (size_class >= 0 && _magazines_enabled) {
+		ptr = magazine_alloc(size_class, flags & AllocFlags::NOWAIT);
+	}
+	
+	if (!ptr) {
+		ptr = heap_alloc(alloc_size, OBJALLOC_MIN_ALIGN, flags);
+	}
+	
+	if (ptr && (flags & AllocFlags::ZERO)) {
+		bzero(ptr, size);
+	}
+	
+	if (ptr && heap_profile.enabled()) {
+		profile_alloc(ptr, caller ? caller : __builtin_return_address(0));
+	}
 	
 	objalloc_log.messagef(LogLevel::DEBUG, "alloc: %lu (%u) = %p", size, flags, ptr);
 	return ptr;
 }
 
-void ObjectAllocator::free(void* ptr)
+/**
+ * Allocates memory for an object with a particular alignment, e.g. CACHE_LINE_SIZE for
+ * objects that must not share a cache line, or a page.
+ * @param size The size of the object
+ * @param align The alignment of the object, which must be a power of two
+ * @param flags Allocation flags, as for alloc.
+ * @param caller The call site that the allocation is attributed to, as for alloc.
+ * @return Returns the object, or NULL if the allocation failed.
+ */
+void *ObjectAllocator::alloc_aligned(size_t size, size_t align, AllocFlags::AllocFlags flags, const void *caller)
 {
-	UniqueLock<Mutex> l(_mtx);
+	assert((align & (align - 1)) == 0);
+	
+	if (!caller) {
+		caller = __builtin_return_address(0);
+	}
+	
+	// Everything is aligned to at least this much anyway.
+	if (align <= OBJALLOC_MIN_ALIGN) {
+		return alloc(size, flags, caller);
+	}
+	
+	// Magazines cannot guarantee any particular alignment, so aligned objects always come
+	// from the heap.  They are still rounded up to a size class, so that they can go into
+	// a magazine when they are freed.
+	int size_class = size_class_of(size);
+	size_t alloc_size = size_class >= 0 ? size_classes[size_class] : size;
+	
+	void *ptr = heap_alloc(alloc_size, align, flags);
+	
+	if (ptr && (flags & AllocFlags::ZERO)) {
+		bzero(ptr, size);
+	}
+	
+	if (ptr && heap_profile.enabled()) {
+		profile_alloc(ptr, caller);
+	}
+	
+	objalloc_log.messagef(LogLevel::DEBUG, "alloc-aligned: %lu, %lu (%u) = %p", size, align, flags, ptr);
+	return ptr;
+}
+
+/**
+ * Frees an object.
+ */
+void ObjectAllocator::free(void *ptr)
+{
+	if (!ptr) {
+		return;
+	}
 	
 	objalloc_log.messagef(LogLevel::DEBUG, "free: %p", ptr);
-	dlfree(ptr);
+	
+	if (heap_profile.enabled()) {
+		profile_free(ptr);
+	}
+	
+	if (_magazines_enabled) {
+		int size_class = size_class_of_usable(dlmalloc_usable_size(ptr));
+		if (size_class >= 0 && magazine_free(ptr, size_class)) {
+			return;
+		}
+	}
+	
+	heap_free(ptr);
+}
+
+/**
+ * Frees an object whose size is known, which saves looking its size up in the heap.
+ * @param ptr The object to free
+ * @param size The size that the object was allocated with
+ */
+void ObjectAllocator::free(void *ptr, size_t size)
+{
+	if (!ptr) {
+		return;
+	}
+	
+	objalloc_log.messagef(LogLevel::DEBUG, "free: %p (%lu)", ptr, size);
+	
+	if (heap_profile.enabled()) {
+		profile_free(ptr);
+	}
+	
+	// The object was rounded up to its size class when it was allocated, so it can be
+	// reused for any object of that class.
+	if (_magazines_enabled) {
+		int size_class = size_class_of(size);
+		if (size_class >= 0 && magazine_free(ptr, size_class)) {
+			return;
+		}
+	}
+	
+	heap_free(ptr);
 }
@@ -0,0 +1,279 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/object-cache.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/object-cache.h>
+#include <infos/mm/object-allocator.h>
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/kernel/kernel.h>
+#include <infos/util/lock.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// Objects are aligned to this boundary, and the slab header is padded to it.
+#define OBJCACHE_ALIGN		16ul
+#define OBJCACHE_ALIGN_UP(__size) (((__size) + OBJCACHE_ALIGN - 1) & ~(OBJCACHE_ALIGN - 1))
+
+// Slabs are made just big enough to hold this many objects, up to the maximum slab order.
+#define OBJCACHE_MIN_OBJECTS	8
+#define OBJCACHE_MAX_ORDER	3
+
+// The general-purpose caches, for objects of up to 512 bytes whose type does not have a
+// cache of its own.
+static ObjectCache size_caches[] = {
+	ObjectCache("size-16", 16),
+	ObjectCache("size-32", 32),
+	ObjectCache("size-48", 48),
+	ObjectCache("size-64", 64),
+	ObjectCache("size-96", 96),
+	ObjectCache("size-128", 128),
+	ObjectCache("size-192", 192),
+	ObjectCache("size-256", 256),
+	ObjectCache("size-384", 384),
+	ObjectCache("size-512", 512),
+};
+
+ObjectCache::ObjectCache(const char *name, size_t object_size, Constructor ctor)
+	: _name(name),
+	  _object_size(OBJCACHE_ALIGN_UP(__max(object_size, sizeof(void *)))),
+	  _ctor(ctor),
+	  _link_offset(ctor ? _object_size : 0),
+	  _slot_size(ctor ? OBJCACHE_ALIGN_UP(_object_size + sizeof(void *)) : _object_size),
+	  _slab_order(0),
+	  _objects_per_slab(0),
+	  _partial(NULL),
+	  _full(NULL),
+	  _nr_empty(0),
+	  _nr_slabs(0),
+	  _nr_active(0)
+{
+	// Use the smallest slab that holds a reasonable number of objects.
+	while (_slab_order < OBJCACHE_MAX_ORDER && objects_per_slab(_slab_order) < OBJCACHE_MIN_OBJECTS) {
+		_slab_order++;
+	}
+
+	_objects_per_slab = objects_per_slab(_slab_order);
+	assert(_objects_per_slab > 0);
+}
+
+/**
+ * Creates a new object cache.
+ * @param name The name of the cache, which must outlive it
+ * @param object_size The size of each object in the cache
+ * @param ctor An optional constructor, which is run on each object when its slab is created
+ * @return Returns the new object cache.
+ */
+ObjectCache *ObjectCache::create(const char *name, size_t object_size, Constructor ctor)
+{
+	return new ObjectCache(name, object_size, ctor);
+}
+
+/**
+ * Returns the number of objects that fit in a slab of 2^order pages, after its header.
+ */
+unsigned int ObjectCache::objects_per_slab(int order) const
+{
+	return ((__page_size << order) - OBJCACHE_ALIGN_UP(sizeof(Slab))) / _slot_size;
+}
+
+/**
+ * Returns the slab containing an object.  Slabs are naturally aligned, so the header is
+ * found by rounding the object's address down to the slab size.
+ */
+ObjectCache::Slab *ObjectCache::slab_of(void *obj) const
+{
+	return (Slab *)((uintptr_t)obj & ~((uintptr_t)(__page_size << _slab_order) - 1));
+}
+
+void ObjectCache::link(Slab *& list, Slab *slab)
+{
+	slab->prev = NULL;
+	slab->next = list;
+
+	if (list) {
+		list->prev = slab;
+	}
+
+	list = slab;
+}
+
+void ObjectCache::unlink(Slab *& list, Slab *slab)
+{
+	if (slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		list = slab->next;
+	}
+
+	if (slab->next) {
+		slab->next->prev = slab->prev;
+	}
+}
+
+/**
+ * Allocates and initialises a new slab.  The cache lock must be held.
+ * @return Returns the new slab, or NULL if the page allocator is out of memory.
+ */
+ObjectCache::Slab *ObjectCache::grow()
+{
+	PageDescriptor *pgd = sys.mm().pgalloc().alloc_pages(_slab_order);
+	if (!pgd) {
+		objalloc_log.messagef(LogLevel::WARNING, "cache %s: unable to allocate slab", _name);
+		return NULL;
+	}
+
+	Slab *slab = (Slab *)sys.mm().pgalloc().pgd_to_vpa(pgd);
+	slab->free_objects = NULL;
+	slab->nr_free = _objects_per_slab;
+
+	// Thread the free list through the objects, so that they are handed out in address order.
+	uintptr_t objects = (uintptr_t)slab + OBJCACHE_ALIGN_UP(sizeof(Slab));
+	for (unsigned int i = _objects_per_slab; i > 0; i--) {
+		void *obj = (void *)(objects + (i - 1) * _slot_size);
+
+		if (_ctor) {
+			_ctor(obj);
+		}
+
+		free_link(obj) = slab->free_objects;
+		slab->free_objects = obj;
+	}
+
+	_nr_slabs++;
+	_nr_empty++;
+
+	objalloc_log.messagef(LogLevel::DEBUG, "cache %s: new slab %p (order=%d, objects=%u)", _name, slab, _slab_order, _objects_per_slab);
+	return slab;
+}
+
+/**
+ * Gives a completely free slab back to the page allocator.  The cache lock must be held.
+ */
+void ObjectCache::release(Slab *slab)
+{
+	assert(slab->nr_free == _objects_per_slab);
+
+	_nr_slabs--;
+	sys.mm().pgalloc().free_pages(sys.mm().pgalloc().vpa_to_pgd((virt_addr_t)slab), _slab_order);
+}
+
+/**
+ * Allocates an object from the cache.
+ * @return Returns the object, or NULL if memory is exhausted.
+ */
+void *ObjectCache::alloc()
+{
+	UniqueLock<Mutex> l(_mtx);
+
+	if (!_partial) {
+		Slab *slab = grow();
+		if (!slab) return NULL;
+
+		link(_partial, slab);
+	}
+
+	Slab *slab = _partial;
+
+	if (slab->nr_free == _objects_per_slab) {
+		_nr_empty--;
+	}
+
+	void *obj = slab->free_objects;
+	slab->free_objects = free_link(obj);
+	slab->nr_free--;
+
+	if (slab->nr_free == 0) {
+		unlink(_partial, slab);
+		link(_full, slab);
+	}
+
+	_nr_active++;
+	return obj;
+}
+
+/**
+ * Returns an object to the cache that it was allocated from.
+ */
+void ObjectCache::free(void *obj)
+{
+	if (!obj) return;
+
+	Slab *slab = slab_of(obj);
+
+	UniqueLock<Mutex> l(_mtx);
+
+	if (slab->nr_free == 0) {
+		unlink(_full, slab);
+		link(_partial, slab);
+	}
+
+	free_link(obj) = slab->free_objects;
+	slab->free_objects = obj;
+	slab->nr_free++;
+
+	_nr_active--;
+
+	if (slab->nr_free == _objects_per_slab) {
+		// Keep a single empty slab around, so that a cache hovering around a slab boundary
+		// does not keep going back to the page allocator.
+		if (_nr_empty > 0) {
+			unlink(_partial, slab);
+			release(slab);
+		} else {
+			_nr_empty++;
+		}
+	}
+}
+
+/**
+ * Returns the general-purpose cache for objects of the given size, or NULL if the size
+ * is too large to be cached.
+ */
+static inline ObjectCache *size_cache(size_t size)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(size_caches); i++) {
+		if (size <= size_caches[i].object_size()) {
+			return &size_caches[i];
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Allocates an object of the given size from the general-purpose caches.  Objects that
+ * are too large to be cached come from the object allocator instead.
+ */
+void *ObjectCache::alloc_sized(size_t size)
+{
+	ObjectCache *cache = size_cache(size);
+	if (!cache) {
+		return sys.mm().objalloc().alloc(size, AllocFlags::NONE, __builtin_return_address(0));
+	}
+
+	return cache->alloc();
+}
+
+/**
+ * Frees an object allocated with alloc_sized.  The size must be the size that the object
+ * was allocated with.
+ */
+void ObjectCache::free_sized(void *obj, size_t size)
+{
+	ObjectCache *cache = size_cache(size);
+	if (!cache) {
+		sys.mm().objalloc().free(obj, size);
+		return;
+	}
+
+	cache->free(obj);
+}
@@ -0,0 +1,283 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/page-alloc-bench.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/util/string.h>
+#include <infos/util/lock.h>
+#include <arch/x86/tsc.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+using namespace infos::arch::x86;
+
+// The number of operations in each benchmark run, the maximum number of allocations that
+// are live at any one time, and the number of operations between fragmentation samples.
+#define BENCH_NR_OPS		200000
+#define BENCH_MAX_LIVE		2048
+#define BENCH_FRAG_INTERVAL	4096
+
+// The largest order that is allocated.  Orders are chosen with geometrically decreasing
+// probability, so that order 0 makes up half of all allocations.
+#define BENCH_MAX_ORDER		10
+
+// Every run uses the same random sequence, so that algorithms can be compared directly.
+#define BENCH_SEED		0x9e3779b97f4a7c15ull
+
+// Latencies are recorded in a log-linear histogram: eight linear sub-buckets per power of two.
+#define HIST_SUB_BITS		3
+#define HIST_NR_BUCKETS		512
+
+namespace BenchmarkAPI
+{
+	enum BenchmarkAPI
+	{
+		ALGORITHM,
+		PGALLOC,
+	};
+}
+
+/**
+ * A histogram of operation latencies, in cycles.
+ */
+struct LatencyHistogram
+{
+	uint64_t buckets[HIST_NR_BUCKETS];
+	uint64_t count, total, max;
+
+	void reset()
+	{
+		bzero(buckets, sizeof(buckets));
+		count = total = max = 0;
+	}
+
+	static unsigned int bucket_of(uint64_t cycles)
+	{
+		if (cycles < (1u << HIST_SUB_BITS))
+			return cycles;
+
+		unsigned int log = 63 - __builtin_clzll(cycles);
+		unsigned int sub = (cycles >> (log - HIST_SUB_BITS)) & ((1u << HIST_SUB_BITS) - 1);
+
+		return ((log - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | sub;
+	}
+
+	static uint64_t bucket_base(unsigned int bucket)
+	{
+		if (bucket < (1u << HIST_SUB_BITS))
+			return bucket;
+
+		unsigned int log = (bucket >> HIST_SUB_BITS) + HIST_SUB_BITS - 1;
+		unsigned int sub = bucket & ((1u << HIST_SUB_BITS) - 1);
+
+		return ((1ull << HIST_SUB_BITS) | sub) << (log - HIST_SUB_BITS);
+	}
+
+	void record(uint64_t cycles)
+	{
+		buckets[bucket_of(cycles)]++;
+		count++;
+		total += cycles;
+		max = __max(max, cycles);
+	}
+
+	/**
+	 * Returns the lower bound of the bucket containing the given percentile.
+	 */
+	uint64_t percentile(unsigned int pct) const
+	{
+		if (count == 0)
+			return 0;
+
+		uint64_t rank = (count * pct + 99) / 100;
+		uint64_t seen = 0;
+
+		for (unsigned int i = 0; i < HIST_NR_BUCKETS; i++)
+		{
+			seen += buckets[i];
+			if (seen >= rank)
+				return bucket_base(i);
+		}
+
+		return max;
+	}
+};
+
+static LatencyHistogram alloc_latency, free_latency;
+
+static PageDescriptor *live_pgds[BENCH_MAX_LIVE];
+static uint8_t live_orders[BENCH_MAX_LIVE];
+
+static uint64_t bench_random_state;
+
+/**
+ * Returns the next number in the benchmark's (xorshift64) random sequence.
+ */
+static inline uint64_t bench_random()
+{
+	bench_random_state ^= bench_random_state << 13;
+	bench_random_state ^= bench_random_state >> 7;
+	bench_random_state ^= bench_random_state << 17;
+
+	return bench_random_state;
+}
+
+/**
+ * Emits the results of a benchmark run for one kind of operation.
+ */
+static void report_latency(const char *alg, const char *api, const char *op, const LatencyHistogram& hist, uint64_t nr_failed)
+{
+	mm_log.messagef(LogLevel::INFO, "PGBENCH alg=%s api=%s op=%s n=%lu failed=%lu mean=%lu p50=%lu p99=%lu max=%lu",
+		alg, api, op, hist.count, nr_failed, hist.count ? hist.total / hist.count : 0,
+		hist.percentile(50), hist.percentile(99), hist.max);
+}
+
+/**
+ * Runs a randomised workload of allocations and frees, of orders 0 to BENCH_MAX_ORDER,
+ * through either the allocation algorithm alone or the full page allocator, and reports
+ * the cost of each operation in cycles.  The results are emitted one run per line, as
+ * space separated key=value pairs following the tag "PGBENCH".
+ */
+void PageAllocator::benchmark_run(int api)
+{
+	const char *api_name = api == BenchmarkAPI::ALGORITHM ? "algorithm" : "pgalloc";
+
+	alloc_latency.reset();
+	free_latency.reset();
+	bench_random_state = BENCH_SEED;
+
+	unsigned int nr_live = 0;
+	uint64_t nr_failed = 0, total_cycles = 0;
+	int peak_frag = -1000, peak_frag_order = 0;
+
+	for (unsigned int op = 0; op < BENCH_NR_OPS; op++)
+	{
+		uint64_t rnd = bench_random();
+
+		if (nr_live == 0 || (nr_live < BENCH_MAX_LIVE && (rnd & 1)))
+		{
+			int order = __builtin_ctzll((rnd >> 1) | (1ull << BENCH_MAX_ORDER));
+			PageDescriptor *pgd;
+
+			uint64_t start = __rdtsc();
+			if (api == BenchmarkAPI::ALGORITHM)
+			{
+				UniqueLock<Mutex> l(_mtx);
+				pgd = take_pages_locked(order, PageDescriptorType::ALLOCATED);
+			}
+			else
+			{
+				pgd = alloc_pages(order);
+			}
+			uint64_t cycles = __rdtsc() - start;
+
+			if (pgd)
+			{
+				live_pgds[nr_live] = pgd;
+				live_orders[nr_live] = order;
+				nr_live++;
+
+				alloc_latency.record(cycles);
+			}
+			else
+			{
+				nr_failed++;
+			}
+
+			total_cycles += cycles;
+		}
+		else
+		{
+			// Free a random live allocation, and fill the hole with the last one.
+			unsigned int victim = (rnd >> 1) % nr_live;
+			PageDescriptor *pgd = live_pgds[victim];
+			int order = live_orders[victim];
+
+			nr_live--;
+			live_pgds[victim] = live_pgds[nr_live];
+			live_orders[victim] = live_orders[nr_live];
+
+			uint64_t start = __rdtsc();
+			if (api == BenchmarkAPI::ALGORITHM)
+			{
+				UniqueLock<Mutex> l(_mtx);
+				return_pages_locked(pgd, order);
+			}
+			else
+			{
+				free_pages(pgd, order);
+			}
+			uint64_t cycles = __rdtsc() - start;
+
+			free_latency.record(cycles);
+			total_cycles += cycles;
+		}
+
+		if ((op % BENCH_FRAG_INTERVAL) == BENCH_FRAG_INTERVAL - 1)
+		{
+			int indices[FRAG_MAX_ORDER];
+			fragmentation_indices(indices);
+
+			for (int order = 0; order <= BENCH_MAX_ORDER; order++)
+			{
+				if (indices[order] > peak_frag)
+				{
+					peak_frag = indices[order];
+					peak_frag_order = order;
+				}
+			}
+		}
+	}
+
+	// Give everything back, so that the next run starts from the same state.
+	while (nr_live > 0)
+	{
+		nr_live--;
+
+		if (api == BenchmarkAPI::ALGORITHM)
+		{
+			UniqueLock<Mutex> l(_mtx);
+			return_pages_locked(live_pgds[nr_live], live_orders[nr_live]);
+		}
+		else
+		{
+			free_pages(live_pgds[nr_live], live_orders[nr_live]);
+		}
+	}
+
+	if (api == BenchmarkAPI::PGALLOC)
+	{
+		drain_page_caches();
+	}
+
+	const char *alg = _allocator_algorithm->name();
+
+	report_latency(alg, api_name, "alloc", alloc_latency, nr_failed);
+	report_latency(alg, api_name, "free", free_latency, 0);
+
+	mm_log.messagef(LogLevel::INFO, "PGBENCH alg=%s api=%s op=all n=%u cycles=%lu ops_per_mcycle=%lu peak_frag=%d peak_frag_order=%d",
+		alg, api_name, BENCH_NR_OPS, total_cycles, total_cycles ? (BENCH_NR_OPS * 1000000ull) / total_cycles : 0,
+		peak_frag, peak_frag_order);
+}
+
+/**
+ * Runs the page allocator benchmark, first against the allocation algorithm on its own,
+ * and then through the per-CPU caches.
+ */
+void PageAllocator::benchmark()
+{
+	mm_log.messagef(LogLevel::IMPORTANT, "PAGE ALLOCATOR BENCHMARK - BEGIN");
+
+	benchmark_run(BenchmarkAPI::ALGORITHM);
+	benchmark_run(BenchmarkAPI::PGALLOC);
+
+	mm_log.messagef(LogLevel::IMPORTANT, "PAGE ALLOCATOR BENCHMARK - COMPLETE");
+}
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/page-allocator-algorithm.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/page-allocator.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+
+void PageAllocatorAlgorithm::dump_state() const
+{
+	pgalloc_log.messagef(LogLevel::WARNING, "dump_state() not implemented in allocation algorithm");
+}
+
+/**
+ * Allocates a number of individual pages, which need not be contiguous.  The default
+ * implementation simply allocates each page in turn, which is only correct for algorithms
+ * that track their own free pages -- algorithms that do not should override it.
+ * @param nr_pages The number of pages to allocate
+ * @param pgds An array that receives the page descriptor of each allocated page
+ * @return Returns the number of pages actually allocated, which may be fewer than requested.
+ */
+unsigned int PageAllocatorAlgorithm::allocate_pages_bulk(unsigned int nr_pages, PageDescriptor **pgds)
+{
+	for (unsigned int i = 0; i < nr_pages; i++)
+	{
+		pgds[i] = allocate_pages(0);
+		if (!pgds[i])
+			return i;
+	}
+
+	return nr_pages;
+}
+
+/**
+ * Frees a number of individual pages.
+ * @param pgds An array of the page descriptors of the pages to free
+ * @param nr_pages The number of pages in the array
+ */
+void PageAllocatorAlgorithm::free_pages_bulk(PageDescriptor **pgds, unsigned int nr_pages)
+{
+	for (unsigned int i = 0; i < nr_pages; i++)
+	{
+		free_pages(pgds[i], 0);
+	}
+}
@@ -10,9 +10,14 @@
  */
 #include <infos/mm/page-allocator.h>
 #include <infos/mm/mm.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/kernel/cpu.h>
 #include <infos/util/string.h>
 #include <infos/util/lock.h>
 #include <infos/util/cmdline.h>
+#include <infos/util/math.h>
+#include <arch/x86/tsc.h>
 
 extern char _IMAGE_START, _IMAGE_END;
 extern char _STACK_START, _STACK_END;
@@ -21,10 +26,20 @@ extern char _HEAP_START;
 using namespace infos::mm;
 using namespace infos::kernel;
 using namespace infos::util;
+using namespace infos::arch::x86;
 
 ComponentLog infos::mm::pgalloc_log(syslog, "pgalloc");
 
 static bool do_self_test;
+static bool do_benchmark;
+static bool do_deferred_init;
+
+// Per-CPU page cache watermarks.  A cache holding more than pcp_high blocks is drained
+// back down to pcp_low, and an empty cache is refilled up to pcp_low.
+static unsigned int pcp_high = 64, pcp_low = 16;
+
+// The number of pre-zeroed pages to keep ready for allocation.
+static unsigned int zero_pool_pages = 128;
 
 RegisterCmdLineArgument(PageAllocDebug, "pgalloc.debug")
 {
@@ -50,7 +65,63 @@ RegisterCmdLineArgument(PageAllocSelfTest, "pgalloc.self-test")
 	}
 }
 
-PageAllocator::PageAllocator(MemoryManager &mm) : Allocator(mm), _page_descriptors(NULL)
+RegisterCmdLineArgument(PageAllocBenchmark, "pgalloc.bench")
+{
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_benchmark = true;
+	}
+	else
+	{
+		do_benchmark = false;
+	}
+}
+
+RegisterCmdLineArgument(PageAllocDeferredInit, "pgalloc.deferred-init")
+{
+	if (strncmp(value, "1", 2) == 0)
+	{
+		do_deferred_init = true;
+	}
+	else
+	{
+		do_deferred_init = false;
+	}
+}
+
+RegisterCmdLineArgument(PageAllocPCPHigh, "pgalloc.pcp-high")
+{
+	pcp_high = strtoul(value, NULL, 0);
+}
+
+RegisterCmdLineArgument(PageAllocPCPLow, "pgalloc.pcp-low")
+{
+	pcp_low = strtoul(value, NULL, 0);
+}
+
+RegisterCmdLineArgument(PageAllocZeroPool, "pgalloc.zero-pool")
+{
+	zero_pool_pages = strtoul(value, NULL, 0);
+}
+
+PageAllocator::PageAllocator(MemoryManager &mm)
+	: Allocator(mm),
+	  _page_descriptors(NULL),
+	  _deferred_pfn(0),
+	  _nr_deferred_pages(0),
+	  _deferred_init_cycles(0),
+	  _pcp_high(0),
+	  _pcp_low(0),
+	  _nr_zero_pool(0),
+	  _zero_pool_high(0),
+	  _zero_pool_low(0),
+	  _zero_pool_hits(0),
+	  _zero_pool_misses(0),
+	  _zeroing_thread(NULL),
+	  _compaction_thread(NULL),
+	  _last_compaction(0),
+	  _nr_compactions(0),
+	  _nr_compaction_failures(0)
 {
 }
 
@@ -75,8 +146,22 @@ bool PageAllocator::setup_page_descriptors()
 
 	// TODO: Actually check this assertion holds, using the size of the physical memory block.
 
-	// Initialise the page descriptors, by zeroing them all.
-	bzero(_page_descriptors, _nr_pages * sizeof(PageDescriptor));
+	// Work out how many of the page descriptors to initialise now.  Normally, this is all
+	// of them -- but with deferred initialisation, only enough memory to boot with is
+	// brought up, and the rest is initialised a section at a time later on.  This must
+	// at least cover the kernel image and the page descriptor array itself, as these
+	// are reserved.
+	if (do_deferred_init)
+	{
+		pfn_t heap_end_pfn = pa_to_pfn(kva_to_pa((virt_addr_t)&_page_descriptors[_nr_pages]) - 1) + 1;
+		pfn_t boot_pfn = __max(heap_end_pfn, PGALLOC_SECTION_PAGES);
+
+		_deferred_pfn = __min(__align_up(boot_pfn, PGALLOC_SECTION_PAGES), _nr_pages);
+	}
+	else
+	{
+		_deferred_pfn = _nr_pages;
+	}
 
 	return true;
 }
@@ -97,33 +182,68 @@ bool PageAllocator::init()
 		return false;
 	}
 
+	// Configure the per-CPU page caches.  A high watermark of zero disables them.
+	// The caches may briefly hold one block more than the high watermark before being drained.
+	bzero(_pcp, sizeof(_pcp));
+	_pcp_high = __min(pcp_high, PCP_MAX_PAGES - 1);
+	_pcp_low = __min(pcp_low, _pcp_high);
+
+	if (_pcp_high)
+	{
+		mm_log.messagef(LogLevel::INFO, "Per-CPU page caches: high=%u, low=%u", _pcp_high, _pcp_low);
+	}
+	else
+	{
+		mm_log.messagef(LogLevel::INFO, "Per-CPU page caches disabled");
+	}
+
+	// Configure the pre-zeroed page pool, which is refilled once it falls below half full.
+	_zero_pool_high = __min(zero_pool_pages, ZERO_POOL_MAX_PAGES);
+	_zero_pool_low = _zero_pool_high / 2;
+
 	// Initialise the page allocator algorithm
 	mm_log.messagef(LogLevel::INFO, "Initialising allocator algorithm '%s'", _allocator_algorithm->name());
-    mm_log.messagef(LogLevel::INFO, "Page Allocator: total=%lu", _nr_pages);
+	mm_log.messagef(LogLevel::INFO, "Page Allocator: total=%lu, descriptors=%lu kB (%lu bytes each; wide=%lu kB, compact=%lu kB)",
+		_nr_pages, KB(_nr_pages * sizeof(PageDescriptor)), sizeof(PageDescriptor),
+		KB(_nr_pages * sizeof(WidePageDescriptorLayout)), KB(_nr_pages * sizeof(CompactPageDescriptorLayout)));
     if (!_allocator_algorithm->init(_page_descriptors, _nr_pages))
 	{
 		mm_log.message(LogLevel::ERROR, "Allocator failed to initialise");
 		return false;
 	}
 
-	uint64_t nr_present_pages, nr_free_pages;
-
-	// Loop through available physical memory blocks, and update the corresponding page descriptors.
-	nr_present_pages = 0;
+	// Only memory that is covered by the physical memory mapping can be handed out,
+	// as allocated pages are accessed through it.
+	pfn_t last_mappable_pfn = pa_to_pfn(PMEM_VA_SIZE);
 	for (unsigned int i = 0; i < owner()._nr_phys_mem_blocks; i++)
 	{
 		const PhysicalMemoryBlock &pmb = owner()._phys_mem_blocks[i];
 
-		if (pmb.type == MemoryType::NORMAL)
+		if (pmb.type == MemoryType::NORMAL && (pmb.base_pfn + pmb.nr_pages) > last_mappable_pfn)
 		{
-			nr_present_pages += pmb.nr_pages;
-			for (pfn_t pfn = pmb.base_pfn; pfn < (pmb.base_pfn + pmb.nr_pages); pfn++)
-			{
-				_page_descriptors[pfn].type = PageDescriptorType::AVAILABLE;
-			}
+			uint64_t nr_ignored = __min(pmb.nr_pages, (pmb.base_pfn + pmb.nr_pages) - last_mappable_pfn);
+			mm_log.messagef(LogLevel::WARNING, "Ignoring %lu pages beyond the physical memory mapping", nr_ignored);
+		}
+	}
+
+	uint64_t nr_present_pages, nr_free_pages;
 
-            _allocator_algorithm->insert_page_range(&_page_descriptors[pmb.base_pfn], pmb.nr_pages);
-        }
+	// Initialise the page descriptors that are needed now, and make the available pages
+	// known to the allocation algorithm.
+	uint64_t init_start = __rdtsc();
+	nr_present_pages = init_page_range(0, _deferred_pfn);
+	uint64_t init_cycles = __rdtsc() - init_start;
+
+	_nr_deferred_pages = count_present_pages(_deferred_pfn, _nr_pages);
+
+	if (_deferred_pfn < _nr_pages)
+	{
+		mm_log.messagef(LogLevel::INFO, "Page descriptors: initialised %lu in %lu cycles, deferred %lu available pages above pfn %lx",
+			_deferred_pfn, init_cycles, _nr_deferred_pages, _deferred_pfn);
+	}
+	else
+	{
+		mm_log.messagef(LogLevel::INFO, "Page descriptors: initialised %lu in %lu cycles", _nr_pages, init_cycles);
 	}
 
     nr_free_pages = nr_present_pages;
@@ -155,9 +275,11 @@ bool PageAllocator::init()
 	// Reserve the whole range from kernel image start to kernel heap end, which eliminates the
 	// problem of overlapping insertions and makes the remove_page_range implementation more efficient
 	pfn_t image_start_pfn = pa_to_pfn((phys_addr_t)&_IMAGE_START); // _IMAGE_START is a PA
-	nr_free_pages -= reserve_page_range(image_start_pfn, ((_nr_pages * sizeof(PageDescriptor)) >> 12) + 1);
+	pfn_t heap_end_pfn = pa_to_pfn(kva_to_pa((virt_addr_t)&_page_descriptors[_nr_pages]) - 1) + 1;
+	nr_free_pages -= reserve_page_range(image_start_pfn, heap_end_pfn - image_start_pfn);
 
-	mm_log.messagef(LogLevel::INFO, "Page Allocator: total=%lu, present=%lu, free=%lu (%u MB)", _nr_pages, nr_present_pages, nr_free_pages, MB(nr_free_pages << 12));
+	mm_log.messagef(LogLevel::INFO, "Page Allocator: total=%lu, present=%lu, free=%lu (%u MB), deferred=%lu",
+		_nr_pages, nr_present_pages, nr_free_pages, MB(nr_free_pages << 12), _nr_deferred_pages);
 
 	// Now, initialise the page allocation algorithm.
 
@@ -170,9 +292,137 @@ bool PageAllocator::init()
 		}
 	}
 
+	if (do_benchmark)
+	{
+		benchmark();
+	}
+
+	return true;
+}
+
+/**
+ * Initialises the page descriptors for a range of PFNs, and inserts the available
+ * pages within it into the allocation algorithm.
+ * @param start The first PFN in the range
+ * @param end The PFN after the last PFN in the range
+ * @return Returns the number of available pages that were inserted.
+ */
+uint64_t PageAllocator::init_page_range(pfn_t start, pfn_t end)
+{
+	bzero(&_page_descriptors[start], (end - start) * sizeof(PageDescriptor));
+
+	end = __min(end, pa_to_pfn(PMEM_VA_SIZE));
+
+	uint64_t nr_available = 0;
+	for (unsigned int i = 0; i < owner()._nr_phys_mem_blocks; i++)
+	{
+		const PhysicalMemoryBlock &pmb = owner()._phys_mem_blocks[i];
+		if (pmb.type != MemoryType::NORMAL)
+			continue;
+
+		pfn_t first = __max(pmb.base_pfn, start);
+		pfn_t last = __min(pmb.base_pfn + pmb.nr_pages, end);
+		if (first >= last)
+			continue;
+
+		for (pfn_t pfn = first; pfn < last; pfn++)
+		{
+			_page_descriptors[pfn].type = PageDescriptorType::AVAILABLE;
+		}
+
+		_allocator_algorithm->insert_page_range(&_page_descriptors[first], last - first);
+		nr_available += last - first;
+	}
+
+	return nr_available;
+}
+
+/**
+ * Counts the available pages in a range of PFNs that can be handed out.
+ */
+uint64_t PageAllocator::count_present_pages(pfn_t start, pfn_t end) const
+{
+	end = __min(end, pa_to_pfn(PMEM_VA_SIZE));
+
+	uint64_t nr_present = 0;
+	for (unsigned int i = 0; i < owner()._nr_phys_mem_blocks; i++)
+	{
+		const PhysicalMemoryBlock &pmb = owner()._phys_mem_blocks[i];
+		if (pmb.type != MemoryType::NORMAL)
+			continue;
+
+		pfn_t first = __max(pmb.base_pfn, start);
+		pfn_t last = __min(pmb.base_pfn + pmb.nr_pages, end);
+		if (first < last)
+			nr_present += last - first;
+	}
+
+	return nr_present;
+}
+
+/**
+ * Initialises the next section of page descriptors whose initialisation was deferred.
+ * Sections are initialised in ascending order, so every descriptor below _deferred_pfn
+ * is always valid.
+ * @return Returns true if a section was initialised, or false if there were none left.
+ */
+bool PageAllocator::init_deferred_section()
+{
+	if (_deferred_pfn >= _nr_pages)
+		return false;
+
+	UniqueLock<Mutex> l(_mtx);
+
+	// Someone else may have got here first.
+	if (_deferred_pfn >= _nr_pages)
+		return false;
+
+	uint64_t start = __rdtsc();
+
+	pfn_t section_end = __min(_deferred_pfn + PGALLOC_SECTION_PAGES, _nr_pages);
+	init_page_range(_deferred_pfn, section_end);
+	_deferred_pfn = section_end;
+
+	_deferred_init_cycles += __rdtsc() - start;
+
+	if (_deferred_pfn >= _nr_pages)
+	{
+		mm_log.messagef(LogLevel::INFO, "Deferred page initialisation complete: %lu pages in %lu cycles",
+			_nr_deferred_pages, _deferred_init_cycles);
+	}
+
 	return true;
 }
 
+/**
+ * The entry point for the background thread that initialises deferred sections.
+ */
+void PageAllocator::deferred_init_threadproc(PageAllocator *pgalloc)
+{
+	while (pgalloc->init_deferred_section())
+	{
+		// Give everything else a chance to run between sections.
+		sys.arch().invoke_kernel_syscall(1);
+	}
+
+	Thread::current().owner().terminate(0);
+}
+
+/**
+ * Starts a background thread to initialise any page descriptors whose initialisation
+ * was deferred at boot.  Sections are also initialised on demand, when an allocation
+ * cannot otherwise be satisfied.
+ */
+void PageAllocator::start_deferred_init()
+{
+	if (_deferred_pfn >= _nr_pages)
+		return;
+
+	Process *init_process = new Process("pgalloc-init", true, (Thread::thread_proc_t)&deferred_init_threadproc, SchedulingEntityPriority::DAEMON);
+	init_process->main_thread().add_entry_argument((void *)this);
+	init_process->start();
+}
+
 uint64_t PageAllocator::reserve_page_range(pfn_t start, uint64_t nr_pages)
 {
     for (pfn_t pfn = start; pfn < start + nr_pages; pfn++)
@@ -185,27 +435,124 @@ uint64_t PageAllocator::reserve_page_range(pfn_t start, uint64_t nr_pages)
 	return nr_pages;
 }
 
+/**
+ * Takes 2^order contiguous pages from the allocation algorithm, and marks them with the
+ * given type.  The allocator lock must be held.
+ * @param order The power of two of the number of pages to allocate
+ * @param type The type that the pages should be given
+ * @return Returns the page descriptor of the first page, or NULL if the algorithm could
+ * not satisfy the request.
+ */
+PageDescriptor *PageAllocator::take_pages_locked(int order, PageDescriptorType::PageDescriptorType type)
+{
+	PageDescriptor *pgd = _allocator_algorithm->allocate_pages(order);
+	if (!pgd)
+		return NULL;
+
+	// Double check that all the pages are marked as available, and
+	// mark them with their new type.
+	for (unsigned int i = 0; i < (1u << order); i++)
+	{
+		assert(pgd[i].type == PageDescriptorType::AVAILABLE);
+		pgd[i].type = type;
+	}
+
+	return pgd;
+}
+
+/**
+ * Returns 2^order contiguous pages to the allocation algorithm.  The allocator lock must be held.
+ * @param pgd A pointer to an array of 2^order contiguous pages
+ * @param order The power of two of the number of pages to free
+ */
+void PageAllocator::return_pages_locked(PageDescriptor *pgd, int order)
+{
+	_allocator_algorithm->free_pages(pgd, order);
+
+	// Double-check that all the pages were allocated, and mark them as available.
+	for (unsigned int i = 0; i < (1u << order); i++)
+	{
+		assert(pgd[i].type == PageDescriptorType::ALLOCATED);
+		pgd[i].type = PageDescriptorType::AVAILABLE;
+		pgd[i].flags &= ~(PageDescriptorFlags::MOVABLE | PageDescriptorFlags::ISOLATED);
+	}
+}
+
 /**
  * Allocates 2^order contiguous pages
  * @param order The power of two of the number of pages to allocate
+ * @param flags Allocation flags.  With AllocFlags::ZERO, the pages are zeroed.  With
+ * AllocFlags::NOWAIT, the slow paths of bringing up deferred memory and compaction are
+ * skipped.
  * @return Returns a pointer to an array of page descriptors representing the new allocation, or NULL if allocation
  * failed.
  */
-PageDescriptor *PageAllocator::alloc_pages(int order)
+PageDescriptor *PageAllocator::alloc_pages(int order, AllocFlags::AllocFlags flags)
 {
 	// Call into the algorithm to actually allocate the pages.
 	if (!_allocator_algorithm)
 		return NULL;
 
-	UniqueLock<Mutex> l(_mtx);
-	PageDescriptor *pgd = _allocator_algorithm->allocate_pages(order);
+	// Zeroed single pages are taken from the pre-zeroed pool where possible.
+	bool use_zero_pool = (flags & AllocFlags::ZERO) && order == 0 && _zero_pool_high;
 
-	// Double check that all the pages are marked as available, and
-	// mark them as allocated.
-	for (unsigned int i = 0; i < (1u << order); i++)
+	PageDescriptor *pgd = NULL;
+	if (use_zero_pool && take_zeroed_pages(&pgd, 1))
 	{
-		assert(pgd[i].type == PageDescriptorType::AVAILABLE);
-		pgd[i].type = PageDescriptorType::ALLOCATED;
+		pgalloc_log.messagef(LogLevel::DEBUG, "alloc: order=%d, pgd=%p (%lx) [zero]", order, pgd, pgd_to_pa(pgd));
+		return pgd;
+	}
+
+	// Small allocations are satisfied from the per-CPU page cache where possible.
+	if (order < PCP_MAX_ORDER && _pcp_high)
+	{
+		pgd = pcp_alloc_pages(order);
+	}
+
+	if (!pgd)
+	{
+		{
+			UniqueLock<Mutex> l(_mtx);
+			pgd = take_pages_locked(order, PageDescriptorType::ALLOCATED);
+		}
+
+		// If the allocation failed, there may be free pages sitting in the allocator's caches
+		// that are preventing the request from being satisfied.  Flush them, and try again.
+		if (!pgd)
+		{
+			drain_page_caches();
+
+			UniqueLock<Mutex> l(_mtx);
+			pgd = take_pages_locked(order, PageDescriptorType::ALLOCATED);
+		}
+
+		// Bring up deferred sections of memory until the request can be satisfied.  This,
+		// and compaction, can take a long time, so they are skipped for NOWAIT requests.
+		while (!pgd && !(flags & AllocFlags::NOWAIT) && init_deferred_section())
+		{
+			UniqueLock<Mutex> l(_mtx);
+			pgd = take_pages_locked(order, PageDescriptorType::ALLOCATED);
+		}
+
+		// As a last resort, there may be enough free memory, but not in one piece.
+		if (!pgd && order > 0 && !(flags & AllocFlags::NOWAIT))
+		{
+			pgd = compact(order);
+		}
+	}
+
+	if (!pgd)
+	{
+		pgalloc_log.messagef(LogLevel::DEBUG, "alloc: order=%d failed", order);
+		return NULL;
+	}
+
+	if (flags & AllocFlags::ZERO)
+	{
+		if (use_zero_pool)
+			_zero_pool_misses++;
+
+		pnzero((void *)pgd_to_vpa(pgd), 1 << order);
 	}
 
 	pgalloc_log.messagef(LogLevel::DEBUG, "alloc: order=%d, pgd=%p (%lx)", order, pgd, pgd_to_pa(pgd));
@@ -221,31 +568,488 @@ void PageAllocator::free_pages(PageDescriptor *pgd, int order)
 {
 	// Call into the algorithm to actually free the pages.
 	if (_allocator_algorithm)
+	{
+		if (order < PCP_MAX_ORDER && _pcp_high)
+		{
+			pcp_free_pages(pgd, order, false);
+		}
+		else
+		{
+			UniqueLock<Mutex> l(_mtx);
+			return_pages_locked(pgd, order);
+		}
+
+		pgalloc_log.messagef(LogLevel::DEBUG, "free: order=%d, pgd=%p (%lx)", order, pgd, pgd_to_pa(pgd));
+	}
+}
+
+/**
+ * Allocates a run of contiguous pages that need not be a power of two in length.  The
+ * run is carved out of the smallest block that holds it, and the rest of the block is
+ * given straight back, so that no memory is wasted on rounding.
+ * @param nr_pages The number of contiguous pages to allocate
+ * @return Returns the first page of the run, or NULL if the allocation failed.
+ */
+PageDescriptor *PageAllocator::alloc_page_run(uint64_t nr_pages, AllocFlags::AllocFlags flags)
+{
+	assert(nr_pages > 0 && nr_pages <= 0xffffffffull);
+
+	int order = ilog2_ceil((uint32_t)nr_pages);
+	PageDescriptor *pgd = alloc_pages(order, flags);
+	if (!pgd)
+		return NULL;
+
+	uint64_t nr_excess = (1ull << order) - nr_pages;
+	if (nr_excess)
+	{
+		free_page_run(pgd + nr_pages, nr_excess);
+	}
+
+	return pgd;
+}
+
+/**
+ * Frees a run of contiguous pages, which may be any part of previously allocated blocks,
+ * as the largest naturally aligned blocks that it can be split into.
+ * @param pgd The first page of the run
+ * @param nr_pages The number of pages in the run
+ */
+void PageAllocator::free_page_run(PageDescriptor *pgd, uint64_t nr_pages)
+{
+	pfn_t pfn = pgd_to_pfn(pgd);
+
+	while (nr_pages > 0)
+	{
+		int order = 0;
+		while (order < HUGE_PAGE_ORDER && (pfn & ((2ull << order) - 1)) == 0 && (2ull << order) <= nr_pages)
+		{
+			order++;
+		}
+
+		free_pages(&_page_descriptors[pfn], order);
+
+		pfn += 1ull << order;
+		nr_pages -= 1ull << order;
+	}
+}
+
+/**
+ * Frees 2^order contiguous pages that are unlikely to be in the CPU cache, so that
+ * they are handed out again only after any cache-hot pages.
+ * @param pgd A pointer to an array of 2^order contiguous pages
+ * @param order The power of two of the number of pages to free
+ */
+void PageAllocator::free_cold_pages(PageDescriptor *pgd, int order)
+{
+	if (order < PCP_MAX_ORDER && _pcp_high && _allocator_algorithm)
+	{
+		pcp_free_pages(pgd, order, true);
+	}
+	else
+	{
+		free_pages(pgd, order);
+	}
+}
+
+/**
+ * Takes a number of individual pages from the allocation algorithm, and marks them as
+ * allocated.  The allocator lock must be held.
+ * @return Returns the number of pages actually allocated.
+ */
+unsigned int PageAllocator::take_pages_bulk_locked(unsigned int nr_pages, PageDescriptor **pgds)
+{
+	unsigned int nr_allocated = _allocator_algorithm->allocate_pages_bulk(nr_pages, pgds);
+
+	for (unsigned int i = 0; i < nr_allocated; i++)
+	{
+		assert(pgds[i]->type == PageDescriptorType::AVAILABLE);
+		pgds[i]->type = PageDescriptorType::ALLOCATED;
+	}
+
+	return nr_allocated;
+}
+
+/**
+ * Allocates a number of individual pages, which need not be physically contiguous, with
+ * a single round-trip through the allocator.  Either all of the requested pages are
+ * allocated, or none of them are.
+ * @param nr_pages The number of pages to allocate
+ * @param pgds An array that receives the page descriptor of each allocated page
+ * @param flags Allocation flags.  With AllocFlags::ZERO, the pages are zeroed.  With
+ * AllocFlags::NOWAIT, the slow paths of bringing up deferred memory and compaction are
+ * skipped.
+ * @return Returns the number of pages allocated, which is either nr_pages or zero.
+ */
+unsigned int PageAllocator::alloc_pages_bulk(unsigned int nr_pages, PageDescriptor **pgds, AllocFlags::AllocFlags flags)
+{
+	if (!_allocator_algorithm || nr_pages == 0)
+		return 0;
+
+	unsigned int nr_allocated = 0;
+
+	// Take as many zeroed pages from the pool as possible.
+	bool use_zero_pool = (flags & AllocFlags::ZERO) && _zero_pool_high;
+	if (use_zero_pool)
+	{
+		nr_allocated = take_zeroed_pages(pgds, nr_pages);
+	}
+
+	unsigned int nr_prezeroed = nr_allocated;
+
+	// Use up whatever is sitting in this CPU's order-0 page cache first.
+	if (_pcp_high)
+	{
+		PageCacheList& list = this_cpu_page_cache().lists[0];
+
+		UniqueIRQLock l;
+		while (nr_allocated < nr_pages && list.count > 0)
+		{
+			PageDescriptor *pgd = list.pop_hot();
+
+			assert(pgd->type == PageDescriptorType::CACHED);
+			pgd->type = PageDescriptorType::ALLOCATED;
+
+			pgds[nr_allocated++] = pgd;
+		}
+	}
+
+	if (nr_allocated < nr_pages)
 	{
 		UniqueLock<Mutex> l(_mtx);
-		_allocator_algorithm->free_pages(pgd, order);
+		nr_allocated += take_pages_bulk_locked(nr_pages - nr_allocated, &pgds[nr_allocated]);
+	}
+
+	// Flush the allocator's caches, and try again if we fell short.
+	if (nr_allocated < nr_pages)
+	{
+		drain_page_caches();
+
+		UniqueLock<Mutex> l(_mtx);
+		nr_allocated += take_pages_bulk_locked(nr_pages - nr_allocated, &pgds[nr_allocated]);
+	}
+
+	// Bringing up deferred memory can take a long time, so it is skipped for NOWAIT requests.
+	while (nr_allocated < nr_pages && !(flags & AllocFlags::NOWAIT) && init_deferred_section())
+	{
+		UniqueLock<Mutex> l(_mtx);
+		nr_allocated += take_pages_bulk_locked(nr_pages - nr_allocated, &pgds[nr_allocated]);
+	}
+
+	if (nr_allocated < nr_pages)
+	{
+		pgalloc_log.messagef(LogLevel::DEBUG, "alloc-bulk: nr=%u failed (got %u)", nr_pages, nr_allocated);
+
+		free_pages_bulk(pgds, nr_allocated);
+		return 0;
+	}
+
+	if (flags & AllocFlags::ZERO)
+	{
+		if (use_zero_pool)
+			_zero_pool_misses += nr_pages - nr_prezeroed;
+
+		for (unsigned int i = nr_prezeroed; i < nr_pages; i++)
+		{
+			pnzero((void *)pgd_to_vpa(pgds[i]), 1);
+		}
+	}
+
+	pgalloc_log.messagef(LogLevel::DEBUG, "alloc-bulk: nr=%u", nr_pages);
+	return nr_pages;
+}
+
+/**
+ * Frees a number of individual pages with a single round-trip through the allocator.  The
+ * pages bypass the per-CPU caches, and are returned directly to the allocation algorithm.
+ * @param pgds An array of the page descriptors of the pages to free
+ * @param nr_pages The number of pages in the array
+ */
+void PageAllocator::free_pages_bulk(PageDescriptor **pgds, unsigned int nr_pages)
+{
+	if (!_allocator_algorithm || nr_pages == 0)
+		return;
+
+	{
+		UniqueLock<Mutex> l(_mtx);
+		_allocator_algorithm->free_pages_bulk(pgds, nr_pages);
 
 		// Double-check that all the pages were allocated, and mark them as available.
+		for (unsigned int i = 0; i < nr_pages; i++)
+		{
+			assert(pgds[i]->type == PageDescriptorType::ALLOCATED);
+			pgds[i]->type = PageDescriptorType::AVAILABLE;
+			pgds[i]->flags &= ~(PageDescriptorFlags::MOVABLE | PageDescriptorFlags::ISOLATED);
+		}
+	}
+
+	pgalloc_log.messagef(LogLevel::DEBUG, "free-bulk: nr=%u", nr_pages);
+}
+
+/**
+ * Returns the page cache belonging to the current CPU.
+ */
+PerCPUPageCache& PageAllocator::this_cpu_page_cache()
+{
+	return _pcp[CPU::current().id()];
+}
+
+/**
+ * Allocates a block of the given order from the per-CPU page cache, refilling the
+ * cache from the allocation algorithm in one batch if it is empty.  The cache itself is
+ * only ever accessed with interrupts disabled, so the common path never touches the
+ * allocator lock.
+ */
+PageDescriptor *PageAllocator::pcp_alloc_pages(int order)
+{
+	PerCPUPageCache& pcp = this_cpu_page_cache();
+	PageCacheList& list = pcp.lists[order];
+
+	for (int attempt = 0; attempt < 2; attempt++)
+	{
+		{
+			UniqueIRQLock l;
+
+			if (list.count > 0)
+			{
+				PageDescriptor *pgd = list.pop_hot();
+				for (unsigned int i = 0; i < (1u << order); i++)
+				{
+					assert(pgd[i].type == PageDescriptorType::CACHED);
+					pgd[i].type = PageDescriptorType::ALLOCATED;
+				}
+
+				return pgd;
+			}
+		}
+
+		if (attempt > 0)
+			break;
+
+		// The cache is empty, so refill it.  The allocator lock must never be taken
+		// with interrupts disabled, as contending on it yields the CPU.
+		unsigned int target = __max(_pcp_low, 1);
+
+		UniqueLock<Mutex> l(_mtx);
+		UniqueIRQLock irq;
+
+		while (list.count < target)
+		{
+			PageDescriptor *pgd = take_pages_locked(order, PageDescriptorType::CACHED);
+			if (!pgd)
+				break;
+
+			list.push_cold(pgd);
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Frees a block of the given order into the per-CPU page cache, draining the cache back
+ * to the allocation algorithm if it has grown past its high watermark.
+ */
+void PageAllocator::pcp_free_pages(PageDescriptor *pgd, int order, bool cold)
+{
+	PerCPUPageCache& pcp = this_cpu_page_cache();
+	PageCacheList& list = pcp.lists[order];
+	bool overflow;
+
+	{
+		UniqueIRQLock l;
+
 		for (unsigned int i = 0; i < (1u << order); i++)
 		{
 			assert(pgd[i].type == PageDescriptorType::ALLOCATED);
-			pgd[i].type = PageDescriptorType::AVAILABLE;
+			pgd[i].type = PageDescriptorType::CACHED;
+			pgd[i].flags &= ~(PageDescriptorFlags::MOVABLE | PageDescriptorFlags::ISOLATED);
 		}
 
-		pgalloc_log.messagef(LogLevel::DEBUG, "free: order=%d, pgd=%p (%lx)", order, pgd, pgd_to_pa(pgd));
+		// The cache always has room for one more block than the high watermark, as it is
+		// drained as soon as it exceeds it.
+		if (cold)
+		{
+			list.push_cold(pgd);
+		}
+		else
+		{
+			list.push_hot(pgd);
+		}
+
+		overflow = list.count > _pcp_high;
+	}
+
+	if (overflow)
+	{
+		pcp_drain(list, order, _pcp_low);
 	}
 }
 
-const PageDescriptor *PageAllocator::alloc_zero_page()
+/**
+ * Returns blocks from the cold end of a per-CPU page cache to the allocation algorithm,
+ * until the cache holds no more than the target number of blocks.
+ */
+void PageAllocator::pcp_drain(PageCacheList& list, int order, unsigned int target)
 {
-	const PageDescriptor *pgd = alloc_page();
-	if (!pgd)
-		return NULL;
+	UniqueLock<Mutex> l(_mtx);
+	UniqueIRQLock irq;
 
-	void *ptr = (void *)pgd_to_vpa(pgd);
-	pzero(ptr);
+	while (list.count > target)
+	{
+		PageDescriptor *pgd = list.pop_cold();
+		for (unsigned int i = 0; i < (1u << order); i++)
+		{
+			assert(pgd[i].type == PageDescriptorType::CACHED);
+			pgd[i].type = PageDescriptorType::ALLOCATED;
+		}
 
-	return pgd;
+		return_pages_locked(pgd, order);
+	}
+}
+
+/**
+ * Returns every block held in the per-CPU page caches, and every page in the pre-zeroed
+ * page pool, to the allocation algorithm.
+ */
+void PageAllocator::drain_page_caches()
+{
+	for (unsigned int cpu = 0; cpu < MAX_CPUS; cpu++)
+	{
+		for (int order = 0; order < PCP_MAX_ORDER; order++)
+		{
+			pcp_drain(_pcp[cpu].lists[order], order, 0);
+		}
+	}
+
+	drain_zero_pool();
+}
+
+/**
+ * Takes up to the given number of pages from the pre-zeroed page pool.
+ * @return Returns the number of pages taken.
+ */
+unsigned int PageAllocator::take_zeroed_pages(PageDescriptor **pgds, unsigned int nr_pages)
+{
+	unsigned int nr_taken = 0;
+
+	UniqueIRQLock l;
+	while (nr_taken < nr_pages && _nr_zero_pool > 0)
+	{
+		PageDescriptor *pgd = _zero_pool[--_nr_zero_pool];
+
+		assert(pgd->type == PageDescriptorType::CACHED);
+		pgd->type = PageDescriptorType::ALLOCATED;
+
+		pgds[nr_taken++] = pgd;
+	}
+
+	_zero_pool_hits += nr_taken;
+	return nr_taken;
+}
+
+/**
+ * Returns every page in the pre-zeroed page pool to the allocation algorithm.
+ */
+void PageAllocator::drain_zero_pool()
+{
+	UniqueLock<Mutex> l(_mtx);
+	UniqueIRQLock irq;
+
+	while (_nr_zero_pool > 0)
+	{
+		PageDescriptor *pgd = _zero_pool[--_nr_zero_pool];
+
+		assert(pgd->type == PageDescriptorType::CACHED);
+		pgd->type = PageDescriptorType::ALLOCATED;
+
+		return_pages_locked(pgd, 0);
+	}
+}
+
+/**
+ * Tops up the pre-zeroed page pool.  The pages are zeroed without holding any locks.
+ */
+void PageAllocator::refill_zero_pool()
+{
+	while (_nr_zero_pool < _zero_pool_high)
+	{
+		PageDescriptor *pgd = alloc_pages(0);
+		if (!pgd)
+			break;
+
+		pnzero((void *)pgd_to_vpa(pgd), 1);
+
+		bool pooled = false;
+		{
+			UniqueIRQLock l;
+
+			if (_nr_zero_pool < _zero_pool_high)
+			{
+				pgd->type = PageDescriptorType::CACHED;
+				_zero_pool[_nr_zero_pool++] = pgd;
+
+				pooled = true;
+			}
+		}
+
+		if (!pooled)
+		{
+			free_pages(pgd, 0);
+			break;
+		}
+	}
+}
+
+/**
+ * The entry point for the background thread that keeps the pre-zeroed page pool topped up.
+ */
+void PageAllocator::zeroing_threadproc(PageAllocator *pgalloc)
+{
+	for (;;)
+	{
+		pgalloc->refill_zero_pool();
+
+		pgalloc_log.messagef(LogLevel::DEBUG, "zero pool: %u pages, hits=%lu, misses=%lu",
+			pgalloc->_nr_zero_pool, pgalloc->_zero_pool_hits, pgalloc->_zero_pool_misses);
+
+		// Sleep until the idle loop notices that the pool is running low.
+		Thread::current().sleep();
+	}
+}
+
+/**
+ * Starts the background thread that zeroes pages for the pre-zeroed page pool.
+ */
+void PageAllocator::start_zeroing_thread()
+{
+	if (!_zero_pool_high)
+		return;
+
+	Process *zeroing_process = new Process("pgzero", true, (Thread::thread_proc_t)&zeroing_threadproc, SchedulingEntityPriority::DAEMON);
+	zeroing_process->main_thread().add_entry_argument((void *)this);
+
+	_zeroing_thread = &zeroing_process->main_thread();
+	zeroing_process->start();
+}
+
+/**
+ * Called when the CPU has nothing else to do.  Wakes the zeroing thread if the pre-zeroed
+ * page pool is running low, so that pages are only ever zeroed in the background when the
+ * CPU would otherwise be idle.  Background compaction is kicked off from here too.
+ */
+void PageAllocator::idle()
+{
+	if (_zeroing_thread && _nr_zero_pool < _zero_pool_low && _zeroing_thread->state() == SchedulingEntityState::SLEEPING)
+	{
+		_zeroing_thread->wake_up();
+	}
+
+	compaction_idle();
+}
+
+const PageDescriptor *PageAllocator::alloc_zero_page()
+{
+	return alloc_pages(0, AllocFlags::ZERO);
 }
 
 bool PageAllocator::self_test()
@@ -366,8 +1170,3 @@ bool PageAllocator::self_test()
 
 	return true;
 }
-
-void PageAllocatorAlgorithm::dump_state() const
-{
-	pgalloc_log.messagef(LogLevel::WARNING, "dump_state() not implemented in allocation algorithm");
-}
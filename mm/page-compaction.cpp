@@ -0,0 +1,376 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * mm/page-compaction.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/vma.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/process.h>
+#include <infos/util/string.h>
+#include <infos/util/printf.h>
+#include <infos/util/lock.h>
+#include <infos/util/cmdline.h>
+
+using namespace infos::mm;
+using namespace infos::kernel;
+using namespace infos::util;
+
+// Background compaction only runs while huge page allocations would fail because free
+// memory is fragmented, rather than because there is too little of it.  A fragmentation
+// index above this threshold indicates the former.
+#define COMPACT_FRAG_THRESHOLD	500
+
+// How often, in seconds, background compaction runs.  Zero disables it.
+static unsigned int compact_interval = 10;
+
+RegisterCmdLineArgument(PageAllocCompactInterval, "pgalloc.compact-interval")
+{
+	compact_interval = strtoul(value, NULL, 0);
+}
+
+static inline bool is_free_page(const PageDescriptor *pgd)
+{
+	return pgd->type == PageDescriptorType::AVAILABLE || pgd->type == PageDescriptorType::CACHED;
+}
+
+static inline bool is_movable_page(const PageDescriptor *pgd)
+{
+	return pgd->type == PageDescriptorType::ALLOCATED && (pgd->flags & PageDescriptorFlags::MOVABLE);
+}
+
+/**
+ * Finds the naturally aligned block of 2^order pages that is cheapest to compact, i.e. the
+ * block containing only free or movable pages that has the fewest movable pages.
+ * @return Returns the first PFN of the block, or _nr_pages if no block can be compacted.
+ */
+pfn_t PageAllocator::find_compaction_block(int order)
+{
+	const uint64_t block_size = 1ull << order;
+
+	// Descriptors above the deferred initialisation point are not valid yet.
+	pfn_t limit = _deferred_pfn;
+
+	pfn_t best = _nr_pages;
+	uint64_t best_nr_movable = block_size + 1;
+
+	for (pfn_t start = 0; start + block_size <= limit; start += block_size)
+	{
+		uint64_t nr_movable = 0;
+		bool candidate = true;
+
+		for (pfn_t pfn = start; pfn < start + block_size; pfn++)
+		{
+			const PageDescriptor *pgd = &_page_descriptors[pfn];
+
+			if (is_movable_page(pgd))
+			{
+				nr_movable++;
+			}
+			else if (!is_free_page(pgd))
+			{
+				candidate = false;
+				break;
+			}
+		}
+
+		if (candidate && nr_movable < best_nr_movable)
+		{
+			best = start;
+			best_nr_movable = nr_movable;
+
+			if (nr_movable == 0)
+				break;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Takes every free page in a block out of the allocation algorithm, and marks it as
+ * isolated, so that it cannot be handed out while the rest of the block is compacted.
+ * @return Returns false, having isolated nothing, if the block contains a page that is
+ * neither free nor movable.
+ */
+bool PageAllocator::isolate_block(pfn_t start, int order)
+{
+	pfn_t end = start + (1ull << order);
+
+	UniqueLock<Mutex> l(_mtx);
+
+	// Any pages that have found their way back into the per-CPU caches since they were
+	// drained count as unmovable, as they cannot be taken from there.
+	for (pfn_t pfn = start; pfn < end; pfn++)
+	{
+		const PageDescriptor *pgd = &_page_descriptors[pfn];
+
+		if (pgd->type != PageDescriptorType::AVAILABLE && !is_movable_page(pgd))
+			return false;
+	}
+
+	pfn_t pfn = start;
+	while (pfn < end)
+	{
+		if (_page_descriptors[pfn].type != PageDescriptorType::AVAILABLE)
+		{
+			pfn++;
+			continue;
+		}
+
+		pfn_t run_end = pfn;
+		while (run_end < end && _page_descriptors[run_end].type == PageDescriptorType::AVAILABLE)
+		{
+			run_end++;
+		}
+
+		_allocator_algorithm->remove_page_range(&_page_descriptors[pfn], run_end - pfn);
+
+		for (; pfn < run_end; pfn++)
+		{
+			_page_descriptors[pfn].type = PageDescriptorType::ALLOCATED;
+			_page_descriptors[pfn].flags |= PageDescriptorFlags::ISOLATED;
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Returns every isolated page in a block to the allocation algorithm.
+ */
+void PageAllocator::release_isolated_pages(pfn_t start, int order)
+{
+	pfn_t end = start + (1ull << order);
+
+	UniqueLock<Mutex> l(_mtx);
+
+	for (pfn_t pfn = start; pfn < end; pfn++)
+	{
+		PageDescriptor *pgd = &_page_descriptors[pfn];
+
+		if (pgd->flags & PageDescriptorFlags::ISOLATED)
+		{
+			return_pages_locked(pgd, 0);
+		}
+	}
+}
+
+/**
+ * Attempts to create a free block of 2^order contiguous pages by migrating movable pages
+ * out of the way.  The block is handed straight to the caller, so that it cannot be taken
+ * by anyone else in the meantime.
+ * @param order The power of two of the number of pages to make contiguous
+ * @return Returns the allocated block, or NULL if no block could be compacted.
+ */
+PageDescriptor *PageAllocator::compact(int order)
+{
+	if (!_allocator_algorithm || order <= 0 || order >= FRAG_MAX_ORDER)
+		return NULL;
+
+	// Compaction may be entered from an allocation made while already compacting.
+	if (!_compact_mtx.try_lock())
+		return NULL;
+
+	// Free pages sitting in the caches would otherwise look unmovable.
+	drain_page_caches();
+
+	PageDescriptor *block = NULL;
+
+	pfn_t start = find_compaction_block(order);
+	if (start < _nr_pages && isolate_block(start, order))
+	{
+		pfn_t end = start + (1ull << order);
+
+		// Any VMA that is busy is skipped, in which case the block will not be completely
+		// isolated, and will be given back.
+		VMA::migrate_range(start, end);
+
+		bool isolated = true;
+		for (pfn_t pfn = start; pfn < end; pfn++)
+		{
+			if (!(_page_descriptors[pfn].flags & PageDescriptorFlags::ISOLATED))
+			{
+				isolated = false;
+				break;
+			}
+		}
+
+		if (isolated)
+		{
+			for (pfn_t pfn = start; pfn < end; pfn++)
+			{
+				_page_descriptors[pfn].flags &= ~PageDescriptorFlags::ISOLATED;
+			}
+
+			block = &_page_descriptors[start];
+		}
+		else
+		{
+			release_isolated_pages(start, order);
+		}
+	}
+
+	if (block)
+	{
+		_nr_compactions++;
+		pgalloc_log.messagef(LogLevel::DEBUG, "compact: order=%d, pfn=%lx", order, start);
+	}
+	else
+	{
+		_nr_compaction_failures++;
+		pgalloc_log.messagef(LogLevel::DEBUG, "compact: order=%d failed", order);
+	}
+
+	_compact_mtx.unlock();
+	return block;
+}
+
+/**
+ * Calculates the fragmentation index of each order below FRAG_MAX_ORDER, from the free
+ * pages recorded in the page descriptors.  An index of -1000 means that an allocation of
+ * that order would succeed.  Otherwise, indices towards 0 mean that it would fail for lack
+ * of memory, and indices towards 1000 mean that it would fail due to fragmentation.  No lock
+ * is taken, so the indices are only approximate.
+ * @param indices An array of FRAG_MAX_ORDER entries that receives the indices
+ */
+void PageAllocator::fragmentation_indices(int *indices)
+{
+	uint64_t nr_blocks[FRAG_MAX_ORDER];
+	uint64_t nr_free_pages = 0, nr_free_blocks = 0;
+
+	bzero(nr_blocks, sizeof(nr_blocks));
+
+	pfn_t limit = _deferred_pfn;
+	pfn_t pfn = 0;
+
+	while (pfn < limit)
+	{
+		if (!is_free_page(&_page_descriptors[pfn]))
+		{
+			pfn++;
+			continue;
+		}
+
+		pfn_t run_end = pfn;
+		while (run_end < limit && is_free_page(&_page_descriptors[run_end]))
+		{
+			run_end++;
+		}
+
+		nr_free_pages += run_end - pfn;
+
+		// Count the run as the naturally aligned blocks that a buddy allocator would hold.
+		while (pfn < run_end)
+		{
+			int order = 0;
+			while (order < FRAG_MAX_ORDER - 1 && (pfn & ((2ull << order) - 1)) == 0 && pfn + (2ull << order) <= run_end)
+			{
+				order++;
+			}
+
+			nr_blocks[order]++;
+			nr_free_blocks++;
+
+			pfn += 1ull << order;
+		}
+	}
+
+	for (int order = 0; order < FRAG_MAX_ORDER; order++)
+	{
+		uint64_t nr_suitable = 0;
+		for (int o = order; o < FRAG_MAX_ORDER; o++)
+		{
+			nr_suitable += nr_blocks[o] << (o - order);
+		}
+
+		if (nr_free_blocks == 0)
+		{
+			indices[order] = 0;
+		}
+		else if (nr_suitable > 0)
+		{
+			indices[order] = -1000;
+		}
+		else
+		{
+			indices[order] = 1000 - (int)((1000 + ((nr_free_pages * 1000) >> order)) / nr_free_blocks);
+		}
+	}
+}
+
+/**
+ * The entry point for the background compaction thread.  Each time it is woken, it makes
+ * a huge page available if memory is too fragmented for one to be allocated.
+ */
+void PageAllocator::compaction_threadproc(PageAllocator *pgalloc)
+{
+	for (;;)
+	{
+		int indices[FRAG_MAX_ORDER];
+
+		pgalloc->fragmentation_indices(indices);
+		if (indices[HUGE_PAGE_ORDER] > COMPACT_FRAG_THRESHOLD)
+		{
+			PageDescriptor *block = pgalloc->compact(HUGE_PAGE_ORDER);
+			if (block)
+			{
+				pgalloc->free_pages(block, HUGE_PAGE_ORDER);
+				pgalloc->fragmentation_indices(indices);
+			}
+		}
+
+		char buffer[FRAG_MAX_ORDER * 6 + 1];
+		int len = 0;
+		for (int order = 0; order < FRAG_MAX_ORDER; order++)
+		{
+			len += snprintf(&buffer[len], sizeof(buffer) - len, " %d", indices[order]);
+		}
+
+		pgalloc_log.messagef(LogLevel::DEBUG, "compaction: compacted=%lu, failed=%lu, fragmentation indices:%s",
+			pgalloc->_nr_compactions, pgalloc->_nr_compaction_failures, buffer);
+
+		pgalloc->_last_compaction = sys.runtime().time_since_epoch().count();
+
+		// Sleep until the idle loop notices that the compaction interval has passed.
+		Thread::current().sleep();
+	}
+}
+
+/**
+ * Starts the background thread that periodically compacts memory.
+ */
+void PageAllocator::start_compaction_thread()
+{
+	if (!compact_interval)
+		return;
+
+	Process *compaction_process = new Process("pgcompact", true, (Thread::thread_proc_t)&compaction_threadproc, SchedulingEntityPriority::DAEMON);
+	compaction_process->main_thread().add_entry_argument((void *)this);
+
+	_last_compaction = sys.runtime().time_since_epoch().count();
+	_compaction_thread = &compaction_process->main_thread();
+	compaction_process->start();
+}
+
+/**
+ * Wakes the background compaction thread if the compaction interval has passed.  This is
+ * called from the idle loop.
+ */
+void PageAllocator::compaction_idle()
+{
+	if (!_compaction_thread || _compaction_thread->state() != SchedulingEntityState::SLEEPING)
+		return;
+
+	uint64_t now = sys.runtime().time_since_epoch().count();
+	if (now - _last_compaction >= (uint64_t)compact_interval * 1000000000ull)
+	{
+		_compaction_thread->wake_up();
+	}
+}
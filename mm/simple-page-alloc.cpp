@@ -26,20 +26,27 @@ private:
 	PageDescriptor *_pgd_base;
 	uint64_t _nr_pgds;
 
+	// Descriptors above the highest inserted page may not have been initialised yet,
+	// so they must not be scanned.
+	uint64_t _scan_limit;
+
 public:
 	bool init(PageDescriptor *page_descriptors, uint64_t nr_page_descriptors) override
 	{
 		mm_log.messagef(LogLevel::DEBUG, "Simple Page Allocator online");
 		_pgd_base = page_descriptors;
 		_nr_pgds = nr_page_descriptors;
+		_scan_limit = 0;
 
 		return true;
 	}
 
 	PageDescriptor *allocate_pages(int order) override
 	{
-		const int nr_pages = (1 << order);
-		for (uint64_t idx = 0; idx < _nr_pgds; idx++)
+		// Only naturally aligned blocks are considered, so that e.g. huge pages can be
+		// mapped directly.  This also lets the search skip over whole blocks at a time.
+		const uint64_t nr_pages = (1ull << order);
+		for (uint64_t idx = 0; idx + nr_pages <= _scan_limit; idx += nr_pages)
 		{
 			bool found = true;
 			for (uint64_t subidx = idx; subidx < idx + nr_pages; subidx++)
@@ -47,7 +54,6 @@ public:
 				if (_pgd_base[subidx].type != PageDescriptorType::AVAILABLE)
 				{
 					found = false;
-					idx = subidx;
 					break;
 				}
 			}
@@ -61,6 +67,22 @@ public:
 		return NULL;
 	}
 
+	unsigned int allocate_pages_bulk(unsigned int nr_pages, PageDescriptor **pgds) override
+	{
+		// This algorithm keeps no state, so the pages can't be taken one by one -- instead,
+		// gather the required number of available pages in a single pass.
+		unsigned int nr_found = 0;
+		for (uint64_t idx = 0; idx < _scan_limit && nr_found < nr_pages; idx++)
+		{
+			if (_pgd_base[idx].type == PageDescriptorType::AVAILABLE)
+			{
+				pgds[nr_found++] = &_pgd_base[idx];
+			}
+		}
+
+		return nr_found;
+	}
+
 	void free_pages(PageDescriptor *pgd, int order) override
 	{
 		PageDescriptor *base = pgd;
@@ -76,6 +98,12 @@ public:
 	virtual void insert_page_range(PageDescriptor *start, uint64_t count) override
 	{
 		mm_log.messagef(LogLevel::DEBUG, "Inserting available page range from %lx -- %lx", sys.mm().pgalloc().pgd_to_pfn(start), sys.mm().pgalloc().pgd_to_pfn(start + count));
+
+		uint64_t end = (start - _pgd_base) + count;
+		if (end > _scan_limit)
+		{
+			_scan_limit = end;
+		}
 	}
 
 	virtual void remove_page_range(PageDescriptor *start, uint64_t count) override
@@ -11,12 +11,71 @@
 #include <infos/mm/vma.h>
 #include <infos/mm/mm.h>
 #include <infos/kernel/kernel.h>
+#include <infos/fs/file.h>
 #include <infos/util/string.h>
+#include <infos/util/cmdline.h>
+#include <infos/util/lock.h>
 
 using namespace infos::mm;
 using namespace infos::kernel;
 using namespace infos::util;
 
+static bool use_huge_pages = true;
+static bool use_demand_paging = true;
+
+RegisterCmdLineArgument(VMAHugePages, "vma.huge-pages")
+{
+	use_huge_pages = strncmp(value, "0", 2) != 0;
+}
+
+RegisterCmdLineArgument(VMADemandPaging, "vma.demand-paging")
+{
+	use_demand_paging = strncmp(value, "0", 2) != 0;
+}
+
+// Address space allocated by allocate_virt_any comes from above this address, leaving the
+// space below it to the program image.
+#define VMA_ANY_BASE		((virt_addr_t)0x100000000u)
+
+// Single pages are given back to the page allocator this many at a time when a VMA is
+// released.
+#define VMA_RELEASE_BATCH	64
+
+// PCIDs tag TLB entries with the address space that they belong to, so that they survive
+// switching to another address space.  PCID 0 is shared by every VMA that does not have a
+// PCID of its own.
+#define VMA_NR_PCIDS		4096
+
+VMA *VMA::_vma_list;
+Mutex VMA::_vma_list_mtx;
+
+// The PCIDs in use, which are protected by the VMA list lock.
+static uint64_t pcid_bitmap[VMA_NR_PCIDS / 64] = { 1 };
+
+/**
+ * Allocates a PCID, or returns 0 if they are all in use.  The VMA list lock must be held.
+ */
+static uint16_t allocate_pcid()
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(pcid_bitmap); i++) {
+		if (pcid_bitmap[i] == ~0ull) continue;
+		
+		unsigned int bit = __builtin_ctzll(~pcid_bitmap[i]);
+		pcid_bitmap[i] |= 1ull << bit;
+		
+		return i * 64 + bit;
+	}
+	
+	return 0;
+}
+
+static void free_pcid(uint16_t pcid)
+{
+	if (pcid == 0) return;
+	
+	pcid_bitmap[pcid / 64] &= ~(1ull << (pcid % 64));
+}
+
 VMA::VMA()
 {
 	auto pgd = allocate_phys(0);
@@ -24,12 +83,127 @@ VMA::VMA()
 	
 	_pgt_phys_base = sys.mm().pgalloc().pgd_to_pa(pgd);
 	_pgt_virt_base = sys.mm().pgalloc().pgd_to_vpa(pgd);
+	
+	UniqueLock<Mutex> l(_vma_list_mtx);
+	
+	// The PCID may have been used by a VMA that has since been released, whose TLB entries
+	// must be flushed before the PCID is used again.
+	_pcid = allocate_pcid();
+	_tlb_flush_pending = true;
+	
+	_prev_vma = NULL;
+	_next_vma = _vma_list;
+	
+	if (_vma_list) {
+		_vma_list->_prev_vma = this;
+	}
+	
+	_vma_list = this;
 }
 
 VMA::~VMA()
 {
-	// TODO: Release allocations
+	{
+		UniqueLock<Mutex> l(_vma_list_mtx);
+		
+		if (_prev_vma) {
+			_prev_vma->_next_vma = _next_vma;
+		} else {
+			_vma_list = _next_vma;
+		}
+		
+		if (_next_vma) {
+			_next_vma->_prev_vma = _prev_vma;
+		}
+	}
 	
+	release();
+}
+
+/**
+ * Tears down the address space, and gives back everything that belongs to it: every page
+ * the VMA allocated (data pages, huge pages, page tables, and the kernel stacks of threads
+ * that ran in it), its regions, and the files that back them.  The kernel half of the
+ * page tables is shared, and is left alone.  Nothing may run in, or use the memory of, the
+ * address space once it has been released.
+ */
+void VMA::release()
+{
+	UniqueLock<Mutex> l(_mtx);
+	release_locked();
+}
+
+/**
+ * Releases the VMA, as release() does, but only if its lock is free.  A thread that was
+ * stopped while it held the lock, e.g. in the middle of populating a page, may never give
+ * it back, so whoever tears the VMA down must not wait for it.
+ * @return Returns false if the lock was busy, in which case nothing was released.
+ */
+bool VMA::try_release()
+{
+	if (!_mtx.try_lock()) return false;
+	
+	release_locked();
+	_mtx.unlock();
+	
+	return true;
+}
+
+/**
+ * Releases the VMA.  The VMA lock must be held.
+ */
+void VMA::release_locked()
+{
+	if (!_pgt_virt_base) return;
+	
+	// Every page table was allocated through the VMA, so it is freed along with the rest of
+	// the allocations, without having to walk the tables.  Page migration must not walk them
+	// once they have been freed.
+	_pgt_phys_base = 0;
+	_pgt_virt_base = 0;
+	
+	{
+		UniqueLock<Mutex> list_lock(_vma_list_mtx);
+		
+		free_pcid(_pcid);
+		_pcid = 0;
+	}
+	
+	auto& pgalloc = sys.mm().pgalloc();
+	
+	PageDescriptor *batch[VMA_RELEASE_BATCH];
+	unsigned int nr_batch = 0;
+	
+	for (const auto& alloc : _page_allocations) {
+		if (alloc.allocation_order != 0) {
+			pgalloc.free_pages(alloc.descriptor_base, alloc.allocation_order);
+			continue;
+		}
+		
+		batch[nr_batch++] = alloc.descriptor_base;
+		
+		if (nr_batch == VMA_RELEASE_BATCH) {
+			pgalloc.free_pages_bulk(batch, nr_batch);
+			nr_batch = 0;
+		}
+	}
+	
+	pgalloc.free_pages_bulk(batch, nr_batch);
+	
+	mm_log.messagef(LogLevel::DEBUG, "vma: released %u allocations", _page_allocations.count());
+	_page_allocations.clear();
+	_movable_allocations.clear();
+	
+	while (VMARegion *region = _regions.first()) {
+		_regions.remove(*region);
+		delete region;
+	}
+	
+	for (auto file : _files) {
+		delete file;
+	}
+	
+	_files.clear();
 }
 
 // This is a hack.  In fact, this whole file is a hack because it's
@@ -129,6 +303,46 @@ struct PTTableEntry : MMUTableEntry {
 } __packed;
 
 void VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFlags flags)
+{
+	UniqueLock<Mutex> l(_mtx);
+	
+	PageDescriptor **table_pool = NULL;
+	unsigned int nr_table_pool = 0;
+
+	map_page(va, pa, flags, false, table_pool, nr_table_pool);
+}
+
+/**
+ * Maps a 2M huge page, by installing a page directory entry that points directly to it.
+ * Both addresses must be 2M aligned, and nothing may already be mapped in the region.
+ */
+void VMA::insert_huge_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFlags flags)
+{
+	assert(__huge_page_offset(va) == 0 && __huge_page_offset(pa) == 0);
+	
+	UniqueLock<Mutex> l(_mtx);
+	
+	PageDescriptor **table_pool = NULL;
+	unsigned int nr_table_pool = 0;
+
+	map_page(va, pa, flags, true, table_pool, nr_table_pool);
+}
+
+/**
+ * Returns a zeroed page to use as a page table, taking it from the given pool of
+ * pre-allocated pages if there are any left, and allocating it otherwise.
+ */
+PageDescriptor *VMA::next_table_page(PageDescriptor **& table_pool, unsigned int& nr_table_pool)
+{
+	if (nr_table_pool > 0) {
+		nr_table_pool--;
+		return *table_pool++;
+	}
+
+	return allocate_tracked(0);
+}
+
+void VMA::map_page(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFlags flags, bool huge, PageDescriptor **& table_pool, unsigned int& nr_table_pool)
 {
 	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
 	va_table_indicies(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
@@ -136,7 +350,7 @@ void VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFl
 	PML4TableEntry *pml4 = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
 	
 	if (pml4->base_address() == 0) {
-		auto pdp = allocate_phys(0);
+		auto pdp = next_table_page(table_pool, nr_table_pool);
 		assert(pdp);
 		
 		pml4->base_address(sys.mm().pgalloc().pgd_to_pa(pdp));
@@ -148,7 +362,7 @@ void VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFl
 	PDPTableEntry *pdp = &((PDPTableEntry *)pa_to_vpa(pml4->base_address()))[pdp_idx];
 	
 	if (pdp->base_address() == 0) {
-		auto pd = allocate_phys(0);
+		auto pd = next_table_page(table_pool, nr_table_pool);
 		assert(pd);
 		
 		pdp->base_address(sys.mm().pgalloc().pgd_to_pa(pd));
@@ -159,8 +373,24 @@ void VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFl
 	
 	PDTableEntry *pd = &((PDTableEntry *)pa_to_vpa(pdp->base_address()))[pd_idx];
 	
+	if (huge) {
+		assert(pd->base_address() == 0);
+		
+		pd->base_address(pa);
+		pd->huge(true);
+		
+		if (flags & MappingFlags::Present) pd->present(true);
+		if (flags & MappingFlags::Writable) pd->writable(true);
+		if (flags & MappingFlags::User) pd->user(true);
+		
+		mm_log.messagef(LogLevel::DEBUG, "vma: mapping huge va=%p -> pa=%p", va, pa);
+		return;
+	}
+	
+	assert(!pd->huge());
+	
 	if (pd->base_address() == 0) {
-		auto pt = allocate_phys(0);
+		auto pt = next_table_page(table_pool, nr_table_pool);
 		assert(pt);
 		
 		pd->base_address(sys.mm().pgalloc().pgd_to_pa(pt));
@@ -180,46 +410,639 @@ void VMA::insert_mapping(virt_addr_t va, phys_addr_t pa, MappingFlags::MappingFl
 	mm_log.messagef(LogLevel::DEBUG, "vma: mapping va=%p -> pa=%p", va, pa);
 }
 
-PageDescriptor *VMA::allocate_phys(int order)
+/**
+ * Counts the number of page tables that would have to be created in order to map
+ * the given range of pages.
+ */
+unsigned int VMA::count_missing_tables(virt_addr_t va, unsigned int nr_pages)
 {
-	auto pgd = sys.mm().pgalloc().alloc_pages(order);
-	if (!pgd) return NULL;
+	unsigned int nr_tables = 0;
+	
+	// Walk the range one page table (i.e. 2M) at a time, remembering which upper-level
+	// tables will already have been created by an earlier step.
+	const uint64_t pt_span = 1ull << 21;
+	virt_addr_t end = va + ((virt_addr_t)nr_pages << __page_bits);
+	uint64_t last_new_pdp = ~0ull, last_new_pd = ~0ull;
 	
+	for (virt_addr_t cur = va & ~(pt_span - 1); cur < end; cur += pt_span) {
+		table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+		va_table_indicies(cur, pml4_idx, pdp_idx, pd_idx, pt_idx);
+		
+		PML4TableEntry *pml4 = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+		PDPTableEntry *pdp = NULL;
+		PDTableEntry *pd = NULL;
+		
+		if (pml4->base_address() != 0) {
+			pdp = &((PDPTableEntry *)pa_to_vpa(pml4->base_address()))[pdp_idx];
+			
+			if (pdp->base_address() != 0) {
+				pd = &((PDTableEntry *)pa_to_vpa(pdp->base_address()))[pd_idx];
+			}
+		}
+		
+		if (!pdp && last_new_pdp != (cur >> 39)) {
+			last_new_pdp = cur >> 39;
+			nr_tables++;
+		}
+		
+		if (!pd && last_new_pd != (cur >> 30)) {
+			last_new_pd = cur >> 30;
+			nr_tables++;
+		}
+		
+		if (!pd || pd->base_address() == 0) {
+			nr_tables++;
+		}
+	}
+	
+	return nr_tables;
+}
+
+/**
+ * Records that a block of physical memory belongs to this VMA.
+ * @return Returns false if there was not enough memory to record the block.
+ */
+bool VMA::track_allocation(PageDescriptor *pgd, int order)
+{
 	PageAllocation pa;
 	pa.descriptor_base = pgd;
 	pa.allocation_order = order;
 	
-	_page_allocations.append(pa);
-	pnzero((void *)sys.mm().pgalloc().pgd_to_vpa(pa.descriptor_base), 1 << order);
+	return _page_allocations.append(pa);
+}
+
+/**
+ * Marks a single page belonging to this VMA as movable, and records where it is tracked so
+ * that it can be found again when it is migrated.  If there is not enough memory to record
+ * it, the page is simply left unmovable.
+ */
+void VMA::mark_movable(PageDescriptor *pgd, unsigned int index)
+{
+	assert(_page_allocations[index].descriptor_base == pgd);
+	
+	if (_movable_allocations.add(pgd, index)) {
+		pgd->flags |= PageDescriptorFlags::MOVABLE;
+	}
+}
+
+/**
+ * Records that a single movable page belonging to this VMA has been replaced by another,
+ * which is then movable in its place.
+ */
+void VMA::replace_allocation(PageDescriptor *old_pgd, PageDescriptor *new_pgd)
+{
+	unsigned int index;
+	if (!_movable_allocations.try_get_value(old_pgd, index)) {
+		assert(false);
+		return;
+	}
+	
+	_movable_allocations.remove(old_pgd);
+	
+	auto& alloc = _page_allocations[index];
+	assert(alloc.descriptor_base == old_pgd && alloc.allocation_order == 0);
+	
+	alloc.descriptor_base = new_pgd;
+	mark_movable(new_pgd, index);
+}
+
+PageDescriptor *VMA::allocate_phys(int order)
+{
+	UniqueLock<Mutex> l(_mtx);
+	return allocate_tracked(order);
+}
+
+/**
+ * Allocates zeroed physical memory that belongs to this VMA.  The VMA lock must be held.
+ */
+PageDescriptor *VMA::allocate_tracked(int order)
+{
+	auto pgd = sys.mm().pgalloc().alloc_pages(order, AllocFlags::ZERO);
+	if (!pgd) return NULL;
+	
+	if (!track_allocation(pgd, order)) {
+		sys.mm().pgalloc().free_pages(pgd, order);
+		return NULL;
+	}
 	
 	return pgd;
 }
 
-bool VMA::allocate_virt_any(int nr_pages)
+static VMARegion *anonymous_region(virt_addr_t va, size_t size, MappingFlags::MappingFlags flags)
+{
+	VMARegion *region = new VMARegion();
+	if (!region) return NULL;
+	
+	region->start = va;
+	region->end = __align_up_page(va + size);
+	region->flags = flags;
+	region->backing = RegionBacking::Anonymous;
+	region->file = NULL;
+	region->file_offset = 0;
+	region->data_start = region->data_end = va;
+	
+	return region;
+}
+
+/**
+ * Reserves a range of free user address space, at an address chosen by the VMA, for
+ * zero-filled, writable memory.  Like any other anonymous region, its pages are allocated
+ * when they are first touched, and any 2M aligned parts of it are backed by huge pages.
+ * @param nr_pages The number of pages to reserve
+ * @param va Receives the start of the range
+ * @return Returns false if there is no free range large enough, or memory is exhausted.
+ */
+bool VMA::allocate_virt_any(int nr_pages, virt_addr_t& va)
+{
+	if (nr_pages <= 0) return false;
+	
+	size_t size = (size_t)nr_pages << __page_bits;
+	
+	// Ranges that are large enough to hold a huge page are 2M aligned, so that they can.
+	bool align_huge = use_huge_pages && size >= __huge_page_size;
+	size_t search_size = align_huge ? size + __huge_page_size - __page_size : size;
+	
+	UniqueLock<Mutex> l(_mtx);
+	
+	if (!find_free_range(search_size, va)) {
+		mm_log.messagef(LogLevel::WARNING, "vma: no free range of %d pages", nr_pages);
+		return false;
+	}
+	
+	if (align_huge) {
+		va = __align_up(va, (virt_addr_t)__huge_page_size);
+	}
+	
+	return add_region(anonymous_region(va, size, MappingFlags::User | MappingFlags::Writable));
+}
+
+/**
+ * Returns true if the 2M region starting at the given (2M aligned) address has nothing
+ * mapped in it, so that it can be mapped with a huge page.
+ */
+bool VMA::can_map_huge(virt_addr_t va)
 {
-	return false;
+	table_idx_t pml4_idx, pdp_idx, pd_idx, pt_idx;
+	va_table_indicies(va, pml4_idx, pdp_idx, pd_idx, pt_idx);
+	
+	PML4TableEntry *pml4 = &((PML4TableEntry *)_pgt_virt_base)[pml4_idx];
+	if (pml4->base_address() == 0) return true;
+	
+	PDPTableEntry *pdp = &((PDPTableEntry *)pa_to_vpa(pml4->base_address()))[pdp_idx];
+	if (pdp->base_address() == 0) return true;
+	
+	// There must not even be an empty page table here, as it would be leaked.
+	PDTableEntry *pd = &((PDTableEntry *)pa_to_vpa(pdp->base_address()))[pd_idx];
+	return pd->base_address() == 0;
 }
 
-bool VMA::allocate_virt(virt_addr_t va, int nr_pages)
+/**
+ * Maps a freshly zeroed huge page over the free, 2M aligned, 2M region at the given address.
+ * Any page tables that are needed to map it are allocated up front, so that mapping cannot
+ * fail.  The VMA lock must be held.
+ * @return Returns false if the memory could not be allocated, in which case nothing is mapped.
+ */
+bool VMA::map_huge_page(virt_addr_t va, MappingFlags::MappingFlags flags)
 {
-	if (nr_pages == 0) return false;
+	assert(can_map_huge(va));
 	
-	int order = __log2ceil(nr_pages);
+	auto& pgalloc = sys.mm().pgalloc();
 	
-	const PageDescriptor *pgd = allocate_phys(order);
-	if (!pgd) {
+	// The region has no page table, and a huge page does not need one, so only the tables
+	// above it can be missing.
+	PageDescriptor *tables[2];
+	unsigned int nr_tables = count_missing_tables(va, 1) - 1;
+	assert(nr_tables <= ARRAY_SIZE(tables));
+	
+	if (!_page_allocations.reserve_additional(1 + nr_tables)) return false;
+	
+	PageDescriptor *pgd = pgalloc.alloc_huge_page(AllocFlags::ZERO);
+	if (!pgd) return false;
+	
+	if (nr_tables > 0 && !pgalloc.alloc_pages_bulk(nr_tables, tables, AllocFlags::ZERO)) {
+		pgalloc.free_huge_page(pgd);
 		return false;
 	}
 	
-	virt_addr_t vbase = va;
-	phys_addr_t pbase = sys.mm().pgalloc().pgd_to_pa(pgd);
-	for (unsigned int i = 0; i < (1u << order); i++) {
-		insert_mapping(vbase, pbase, MappingFlags::Present | MappingFlags::User | MappingFlags::Writable);
+	track_allocation(pgd, HUGE_PAGE_ORDER);
+	for (unsigned int i = 0; i < nr_tables; i++) {
+		track_allocation(tables[i], 0);
+	}
+	
+	PageDescriptor **table_pool = tables;
+	unsigned int nr_table_pool = nr_tables;
+	
+	map_page(va, pgalloc.pgd_to_pa(pgd), flags | MappingFlags::Present, true, table_pool, nr_table_pool);
+	assert(nr_table_pool == 0);
+	
+	return true;
+}
+
+/**
+ * Returns true if the 2M aligned, 2M region at the given address lies entirely within a single
+ * region, and none of it comes from a file, so that it can be backed by a zeroed huge page.
+ * The VMA lock must be held.
+ */
+bool VMA::is_zero_fill_huge(virt_addr_t va) const
+{
+	virt_addr_t end = va + __huge_page_size;
+	
+	VMARegion *region = first_region_ending_after(va);
+	if (!region || region->start > va || region->end < end) return false;
+	
+	return region->backing != RegionBacking::File || region->data_end <= va || region->data_start >= end;
+}
+
+/**
+ * Backs an anonymous region with freshly zeroed pages, when it is populated up front rather
+ * than on demand.  Pages in the region that are already mapped are left alone.  Any 2M
+ * aligned parts of the region are mapped with huge pages; the remaining data pages, and any
+ * page tables needed to map them, are obtained from the page allocator in a single bulk
+ * allocation, and need not be physically contiguous.  The VMA lock must be held.
+ */
+bool VMA::populate_anonymous(const VMARegion& region)
+{
+	assert(region.backing == RegionBacking::Anonymous);
+	
+	virt_addr_t va = __page_base(region.start);
+	int nr_pages = (__align_up_page(region.end) - va) >> __page_bits;
+	MappingFlags::MappingFlags flags = region.flags | MappingFlags::Present;
+	
+	// Back any 2M aligned parts of the region with huge pages first.  Whatever is left
+	// over is then filled in with small pages.
+	if (use_huge_pages) {
+		for (virt_addr_t cur = __align_up(va, (virt_addr_t)__huge_page_size); cur + __huge_page_size <= region.end; cur += __huge_page_size) {
+			if (!can_map_huge(cur)) continue;
+			if (!map_huge_page(cur, flags)) break;
+		}
+	}
+	
+	unsigned int nr_data_pages = 0;
+	for (int i = 0; i < nr_pages; i++) {
+		if (!is_mapped(va + ((virt_addr_t)i << __page_bits))) {
+			nr_data_pages++;
+		}
+	}
+	
+	if (nr_data_pages == 0) return true;
+	
+	unsigned int nr_table_pages = count_missing_tables(va, nr_pages);
+	unsigned int nr_total_pages = nr_data_pages + nr_table_pages;
+	
+	// Make room to track every page up front, so that recording them cannot fail.
+	if (!_page_allocations.reserve_additional(nr_total_pages)) return false;
+	
+	PageDescriptor **pgds = new PageDescriptor *[nr_total_pages];
+	if (!pgds) return false;
+	
+	if (!sys.mm().pgalloc().alloc_pages_bulk(nr_total_pages, pgds, AllocFlags::ZERO)) {
+		delete[] pgds;
+		return false;
+	}
+	
+	unsigned int first_index = _page_allocations.count();
+	for (unsigned int i = 0; i < nr_total_pages; i++) {
+		track_allocation(pgds[i], 0);
+	}
+	
+	PageDescriptor **table_pool = &pgds[nr_data_pages];
+	unsigned int nr_table_pool = nr_table_pages;
+	
+	unsigned int next_data_page = 0;
+	for (int i = 0; i < nr_pages; i++) {
+		virt_addr_t vaddr = va + ((virt_addr_t)i << __page_bits);
+		if (is_mapped(vaddr)) continue;
+		
+		// Data pages are only ever accessed through this mapping, so they can be migrated.
+		PageDescriptor *data_pgd = pgds[next_data_page];
+		mark_movable(data_pgd, first_index + next_data_page++);
 		
-		vbase += 0x1000;
-		pbase += 0x1000;
+		phys_addr_t paddr = sys.mm().pgalloc().pgd_to_pa(data_pgd);
+		map_page(vaddr, paddr, flags, false, table_pool, nr_table_pool);
 	}
 	
+	assert(next_data_page == nr_data_pages);
+	assert(nr_table_pool == 0);
+	
+	delete[] pgds;
+	return true;
+}
+
+/**
+ * Adds a region of zero-filled memory, whose pages are allocated when they are first touched.
+ * @param va The start of the region, which must be page aligned
+ * @param size The size of the region
+ * @param flags The flags that the region's pages are mapped with
+ * @return Returns false if the region could not be added.
+ */
+bool VMA::add_anonymous_region(virt_addr_t va, size_t size, MappingFlags::MappingFlags flags)
+{
+	assert(__page_offset(va) == 0);
+	
+	UniqueLock<Mutex> l(_mtx);
+	return add_region(anonymous_region(va, size, flags));
+}
+
+/**
+ * Adds a region whose contents are read from a file when its pages are first touched.  The
+ * region covers exactly [va, va + size), and anything in it that does not come from the
+ * file is zero-filled.
+ * @param va The address at which the file contents start, which need not be page aligned
+ * @param size The size of the region from va, which must be at least file_size
+ * @param flags The flags that the region's pages are mapped with
+ * @param file The file, which must outlive the VMA (see adopt_file)
+ * @param file_offset The offset in the file of the contents
+ * @param file_size The number of bytes to take from the file
+ * @return Returns false if the region could not be added.
+ */
+bool VMA::add_file_region(virt_addr_t va, size_t size, MappingFlags::MappingFlags flags, fs::File& file, off_t file_offset, size_t file_size)
+{
+	assert(file_size <= size);
+	
+	VMARegion *region = new VMARegion();
+	if (!region) return false;
+	
+	region->start = va;
+	region->end = va + size;
+	region->flags = flags;
+	region->backing = RegionBacking::File;
+	region->file = &file;
+	region->file_offset = file_offset;
+	region->data_start = va;
+	region->data_end = va + file_size;
+	
+	UniqueLock<Mutex> l(_mtx);
+	return add_region(region);
+}
+
+/**
+ * Hands ownership of a file that backs regions of this VMA to the VMA, so that the file is
+ * deleted when the VMA is.
+ */
+void VMA::adopt_file(fs::File *file)
+{
+	UniqueLock<Mutex> l(_mtx);
+	
+	if (!_files.append(file)) {
+		// The file cannot be tracked, so it has to be leaked to keep the regions valid.
+		mm_log.messagef(LogLevel::WARNING, "vma: unable to adopt file %p", file);
+	}
+}
+
+/**
+ * Inserts a region into the region tree, taking ownership of it.  The VMA lock must be held.
+ * @param region The region, or NULL if it could not be allocated
+ * @return Returns false if the region overlaps an existing one, or could not be populated.
+ */
+bool VMA::add_region(VMARegion *region)
+{
+	if (!region) return false;
+	
+	if (region->end <= region->start) {
+		delete region;
+		return true;
+	}
+	
+	VMARegion *next = first_region_ending_after(region->start);
+	if (next && next->start < region->end) {
+		mm_log.messagef(LogLevel::WARNING, "vma: region %p-%p overlaps region %p-%p", region->start, region->end, next->start, next->end);
+		
+		delete region;
+		return false;
+	}
+	
+	_regions.insert(*region);
+	
+	// Without demand paging, every page of the region is populated up front.  If that fails,
+	// the region is dropped again.  Any pages that were populated are already tracked, so
+	// they are released along with the rest of the VMA.
+	if (!use_demand_paging && !populate_region(*region)) {
+		_regions.remove(*region);
+		delete region;
+		
+		return false;
+	}
+	
+	return true;
+}
+
+/**
+ * Populates every page of a region.  Anonymous regions are populated in bulk, while the
+ * pages of other regions are read in one at a time.  The VMA lock must be held.
+ */
+bool VMA::populate_region(const VMARegion& region)
+{
+	if (region.backing == RegionBacking::Anonymous) {
+		return populate_anonymous(region);
+	}
+	
+	for (virt_addr_t va = __page_base(region.start); va < region.end; va += __page_size) {
+		if (!populate(va, false)) return false;
+	}
+	
+	return true;
+}
+
+/**
+ * Returns the lowest region that ends after the given address, or NULL if there is none.
+ * As regions do not overlap, they are ordered by their end addresses as well as their start
+ * addresses, so this is also the first region that can contain the address.  The VMA lock
+ * must be held.
+ */
+VMARegion *VMA::first_region_ending_after(virt_addr_t va) const
+{
+	VMARegion *found = NULL;
+	VMARegion *region = _regions.root();
+	
+	while (region) {
+		if (region->end > va) {
+			found = region;
+			region = RegionTree::left(*region);
+		} else {
+			region = RegionTree::right(*region);
+		}
+	}
+	
+	return found;
+}
+
+/**
+ * Returns the size of the page-aligned space between the end of one region and the start of
+ * the next, which may share a page.
+ */
+static inline size_t region_gap(virt_addr_t prev_end, virt_addr_t next_start)
+{
+	virt_addr_t from = __align_up_page(prev_end);
+	virt_addr_t to = __page_base(next_start);
+	
+	return to > from ? to - from : 0;
+}
+
+void VMARegion::Augment::update(VMARegion& region, VMARegion *left, VMARegion *right)
+{
+	region.subtree_start = left ? left->subtree_start : region.start;
+	region.subtree_end = right ? right->subtree_end : region.end;
+	region.subtree_max_gap = 0;
+	
+	if (left) {
+		region.subtree_max_gap = __max(left->subtree_max_gap, region_gap(left->subtree_end, region.start));
+	}
+	
+	if (right) {
+		region.subtree_max_gap = __max(region.subtree_max_gap, __max(right->subtree_max_gap, region_gap(region.end, right->subtree_start)));
+	}
+}
+
+/**
+ * Finds the lowest free, page-aligned range of the given size that lies at or above a floor,
+ * and below the last region of a subtree.  Subtrees whose gaps are all too small, or all
+ * below the floor, are skipped without being visited.
+ * @param region The root of the subtree
+ * @param floor The lowest address of the range, which must not be below the end of the
+ * region before the subtree
+ * @param size The size of the range
+ * @param va Receives the start of the range
+ * @return Returns true if a range was found.
+ */
+bool VMA::find_gap(VMARegion *region, virt_addr_t floor, size_t size, virt_addr_t& va)
+{
+	if (!region) return false;
+	if (region->subtree_end <= floor) return false;
+	if (region->subtree_max_gap < size && region_gap(floor, region->subtree_start) < size) return false;
+	
+	VMARegion *left = RegionTree::left(*region);
+	if (find_gap(left, floor, size, va)) return true;
+	
+	virt_addr_t from = left ? __max(floor, left->subtree_end) : floor;
+	if (region_gap(from, region->start) >= size) {
+		va = __align_up_page(from);
+		return true;
+	}
+	
+	return find_gap(RegionTree::right(*region), __max(floor, region->end), size, va);
+}
+
+/**
+ * Finds the lowest free, page-aligned range of user address space of the given size, at or
+ * above VMA_ANY_BASE.  The VMA lock must be held.
+ */
+bool VMA::find_free_range(size_t size, virt_addr_t& va) const
+{
+	VMARegion *root = _regions.root();
+	if (find_gap(root, VMA_ANY_BASE, size, va)) return true;
+	
+	// Otherwise, the range has to go after the last region.
+	virt_addr_t from = root ? __max(VMA_ANY_BASE, root->subtree_end) : VMA_ANY_BASE;
+	if (region_gap(from, USER_VMEM_END) < size) return false;
+	
+	va = __align_up_page(from);
+	return true;
+}
+
+/**
+ * Resolves a fault on a page that is not present, by populating it from the regions that
+ * cover it.
+ * @param va The address that faulted
+ * @param write True if the fault was caused by a write
+ * @return Returns true if the page is now mapped, and the access can be retried.
+ */
+bool VMA::handle_fault(virt_addr_t va, bool write)
+{
+	UniqueLock<Mutex> l(_mtx);
+	return populate(va, write);
+}
+
+/**
+ * Allocates and maps the page containing an address, and fills it from every region that
+ * covers it.  Regions can share a page, e.g. the end of one ELF segment and the start of
+ * the next, in which case the page is mapped with the permissions of both.  The VMA lock
+ * must be held.
+ * @return Returns false if no region covers the page, the access is not permitted, or
+ * memory could not be allocated.
+ */
+bool VMA::populate(virt_addr_t va, bool write)
+{
+	va = __page_base(va);
+	
+	// Another thread may have populated the page first.
+	if (is_mapped(va)) return true;
+	
+	// Only the regions that intersect the page are visited, in order.
+	VMARegion *first = first_region_ending_after(va);
+	virt_addr_t page_end = va + __page_size;
+	
+	MappingFlags::MappingFlags flags = MappingFlags::None;
+	bool covered = false;
+	
+	for (VMARegion *region = first; region && region->start < page_end; region = _regions.next(*region)) {
+		flags = flags | region->flags;
+		covered = true;
+	}
+	
+	if (!covered) return false;
+	if (write && !(flags & MappingFlags::Writable)) return false;
+	
+	// Zero-filled memory that covers a whole 2M aligned region is mapped with a huge page, if
+	// one can be had.  Otherwise, only the page that faulted is populated.
+	virt_addr_t huge_va = va & ~((virt_addr_t)__huge_page_size - 1);
+	if (use_huge_pages && is_zero_fill_huge(huge_va) && can_map_huge(huge_va) && map_huge_page(huge_va, flags)) {
+		return true;
+	}
+	
+	auto& pgalloc = sys.mm().pgalloc();
+	
+	PageDescriptor *pgd = pgalloc.alloc_pages(0, AllocFlags::ZERO);
+	if (!pgd) return false;
+	
+	uint8_t *page = (uint8_t *)pgalloc.pgd_to_vpa(pgd);
+	
+	for (VMARegion *region = first; region && region->start < page_end; region = _regions.next(*region)) {
+		if (region->backing != RegionBacking::File) continue;
+		
+		virt_addr_t from = __max(va, region->data_start);
+		virt_addr_t to = __min(page_end, region->data_end);
+		if (from >= to) continue;
+		
+		int size = to - from;
+		if (region->file->pread(&page[from - va], size, region->file_offset + (from - region->data_start)) != size) {
+			mm_log.messagef(LogLevel::ERROR, "vma: unable to read contents of page va=%p", va);
+			
+			pgalloc.free_pages(pgd, 0);
+			return false;
+		}
+	}
+	
+	// Allocate any page tables that are needed to map the page, and make room to track them
+	// along with the page itself, before anything is mapped, so that mapping cannot fail.
+	PageDescriptor *tables[3];
+	unsigned int nr_tables = count_missing_tables(va, 1);
+	assert(nr_tables <= ARRAY_SIZE(tables));
+	
+	if (!_page_allocations.reserve_additional(1 + nr_tables)) {
+		pgalloc.free_pages(pgd, 0);
+		return false;
+	}
+	
+	if (nr_tables > 0 && !pgalloc.alloc_pages_bulk(nr_tables, tables, AllocFlags::ZERO)) {
+		pgalloc.free_pages(pgd, 0);
+		return false;
+	}
+	
+	unsigned int index = _page_allocations.count();
+	track_allocation(pgd, 0);
+	for (unsigned int i = 0; i < nr_tables; i++) {
+		track_allocation(tables[i], 0);
+	}
+	
+	// The page is only ever accessed through this mapping, so it can be migrated.
+	mark_movable(pgd, index);
+	
+	PageDescriptor **table_pool = tables;
+	unsigned int nr_table_pool = nr_tables;
+	
+	map_page(va, pgalloc.pgd_to_pa(pgd), flags | MappingFlags::Present, false, table_pool, nr_table_pool);
+	assert(nr_table_pool == 0);
+	
 	return true;
 }
 
@@ -254,6 +1077,11 @@ bool VMA::get_mapping(virt_addr_t va, phys_addr_t& pa)
 		return false;
 	}
 	
+	if (pd->huge()) {
+		pa = pd->base_address() | __huge_page_offset(va);
+		return true;
+	}
+	
 	PTTableEntry *pt = &((PTTableEntry *)pa_to_vpa(pd->base_address()))[pt_idx];
 	
 	if (!pt->present()) {
@@ -267,18 +1095,126 @@ bool VMA::get_mapping(virt_addr_t va, phys_addr_t& pa)
 
 bool VMA::copy_to(virt_addr_t dest_va, const void* src, size_t size)
 {
-	phys_addr_t pa;
-	if (!get_mapping(dest_va, pa))
-		return false;
+	// The destination pages need not be physically contiguous, so copy one page at a time.
+	const uint8_t *src_bytes = (const uint8_t *)src;
+	
+	UniqueLock<Mutex> l(_mtx);
+	
+	while (size > 0) {
+		// Pages of a region that have not been touched yet are populated first.
+		phys_addr_t pa;
+		if (!get_mapping(dest_va, pa) && (!populate(dest_va, false) || !get_mapping(dest_va, pa)))
+			return false;
+		
+		size_t chunk = __min(size, __page_size - __page_offset(dest_va));
+		
+		//mm_log.messagef(LogLevel::DEBUG, "vma: copy-to dst=va=%p:pa=%p src=%p size=%p", dest_va, pa, src_bytes, chunk);
+		memcpy((void *)pa_to_vpa(pa), src_bytes, chunk);
+		
+		dest_va += chunk;
+		src_bytes += chunk;
+		size -= chunk;
+	}
 	
-	void *dest = (void *)pa_to_vpa(pa);
+	return true;
+}
+
+/**
+ * Moves the contents of every movable page mapped by this VMA, whose frame lies in the
+ * given range, into a newly allocated page, and remaps it.  The VMA lock must be held.
+ * The old pages are left allocated, and marked as isolated, for the caller to reclaim.
+ * @return Returns false if a page could not be migrated.
+ */
+bool VMA::migrate_pages(pfn_t start, pfn_t end)
+{
+	// The VMA has been released, and has nothing left to migrate.
+	if (!_pgt_virt_base) return true;
 	
-	//mm_log.messagef(LogLevel::DEBUG, "vma: copy-to dst=va=%p:pa=%p:vpa=%p src=%p size=%p", dest_va, pa, dest, src, size);
-	memcpy(dest, src, size);
+	auto& pgalloc = sys.mm().pgalloc();
+	
+	// Only the user half of the address space is walked, as the kernel half is shared.
+	PML4TableEntry *pml4 = (PML4TableEntry *)_pgt_virt_base;
+	for (unsigned int pml4_idx = 0; pml4_idx < 0x100; pml4_idx++) {
+		if (!pml4[pml4_idx].present()) continue;
+		
+		PDPTableEntry *pdp = (PDPTableEntry *)pa_to_vpa(pml4[pml4_idx].base_address());
+		for (unsigned int pdp_idx = 0; pdp_idx < 0x200; pdp_idx++) {
+			if (!pdp[pdp_idx].present() || pdp[pdp_idx].huge()) continue;
+			
+			PDTableEntry *pd = (PDTableEntry *)pa_to_vpa(pdp[pdp_idx].base_address());
+			for (unsigned int pd_idx = 0; pd_idx < 0x200; pd_idx++) {
+				if (!pd[pd_idx].present() || pd[pd_idx].huge()) continue;
+				
+				PTTableEntry *pt = (PTTableEntry *)pa_to_vpa(pd[pd_idx].base_address());
+				for (unsigned int pt_idx = 0; pt_idx < 0x200; pt_idx++) {
+					if (!pt[pt_idx].present()) continue;
+					
+					pfn_t pfn = pa_to_pfn(pt[pt_idx].base_address());
+					if (pfn < start || pfn >= end) continue;
+					
+					PageDescriptor *old_pgd = pgalloc.pfn_to_pgd(pfn);
+					if (!(old_pgd->flags & PageDescriptorFlags::MOVABLE)) continue;
+					
+					PageDescriptor *new_pgd = pgalloc.alloc_pages(0);
+					if (!new_pgd) return false;
+					
+					virt_addr_t va = (virt_addr_t)pml4_idx << 39 | (virt_addr_t)pdp_idx << 30 | (virt_addr_t)pd_idx << 21 | (virt_addr_t)pt_idx << 12;
+					
+					{
+						// Nothing else can touch the page while interrupts are disabled, so it
+						// is safe to copy it and switch the mapping over.
+						UniqueIRQLock irq;
+						
+						memcpy((void *)pgalloc.pgd_to_vpa(new_pgd), (const void *)pgalloc.pgd_to_vpa(old_pgd), __page_size);
+						pt[pt_idx].base_address(pgalloc.pgd_to_pa(new_pgd));
+						
+						// This only flushes the mapping from the current PCID, so the VMA's own
+						// PCID is flushed the next time it is loaded.
+						asm volatile("invlpg (%0)" :: "r"(va) : "memory");
+						_tlb_flush_pending = true;
+					}
+					
+					mm_log.messagef(LogLevel::DEBUG, "vma: migrated va=%p from pfn=%lx to pfn=%lx", va, pfn, pgalloc.pgd_to_pfn(new_pgd));
+					
+					replace_allocation(old_pgd, new_pgd);
+					
+					old_pgd->flags &= ~PageDescriptorFlags::MOVABLE;
+					old_pgd->flags |= PageDescriptorFlags::ISOLATED;
+				}
+			}
+		}
+	}
 	
 	return true;
 }
 
+/**
+ * Migrates every movable page in the given range of page frames out of it, across every
+ * VMA.  VMAs that are busy are skipped, as the caller may already hold their locks.
+ * @return Returns true if every VMA was migrated successfully.
+ */
+bool VMA::migrate_range(pfn_t start, pfn_t end)
+{
+	if (!_vma_list_mtx.try_lock()) return false;
+	
+	bool complete = true;
+	for (VMA *vma = _vma_list; vma; vma = vma->_next_vma) {
+		if (!vma->_mtx.try_lock()) {
+			complete = false;
+			continue;
+		}
+		
+		if (!vma->migrate_pages(start, end)) {
+			complete = false;
+		}
+		
+		vma->_mtx.unlock();
+	}
+	
+	_vma_list_mtx.unlock();
+	return complete;
+}
+
 void VMA::dump()
 {
 	PML4TableEntry *te = (PML4TableEntry *)_pgt_virt_base;
@@ -0,0 +1,315 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * tools/host-bench/host-bench.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "host-bench.h"
+
+// The workload produced by the trace generator matches the in-kernel benchmark
+// (pgalloc.bench=1): orders 0 to 10, each half as likely as the one below, with at most
+// 2048 allocations live at once.
+#define GEN_MAX_ORDER		10
+#define GEN_MAX_LIVE		2048
+#define GEN_DEFAULT_SEED	0x9e3779b97f4a7c15ull
+
+// 4G of memory.
+#define DEFAULT_NR_PAGES	(1ul << 20)
+
+/**
+ * A single operation in an allocation trace.  Allocations are identified by a slot number,
+ * so that a trace can be replayed against any algorithm.
+ */
+struct TraceOp
+{
+	bool alloc;
+	int order;
+	unsigned int slot;
+};
+
+struct Allocation
+{
+	long pfn;
+	int order;
+};
+
+static inline uint64_t rdtsc()
+{
+	return __builtin_ia32_rdtsc();
+}
+
+static inline uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * Reads a trace.  Each line is either "a <slot> <order>", which allocates 2^order pages
+ * into a slot, or "f <slot>", which frees the allocation in a slot.  Blank lines and lines
+ * starting with '#' are ignored.
+ */
+static bool read_trace(const char *filename, std::vector<TraceOp>& ops, unsigned int& nr_slots)
+{
+	FILE *f = strcmp(filename, "-") == 0 ? stdin : fopen(filename, "r");
+	if (!f) {
+		perror(filename);
+		return false;
+	}
+
+	char line[128];
+	unsigned int lineno = 0;
+	bool ok = true;
+
+	nr_slots = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		if (line[0] == '#' || line[0] == '\n') continue;
+
+		TraceOp op;
+		if (sscanf(line, "a %u %d", &op.slot, &op.order) == 2) {
+			op.alloc = true;
+		} else if (sscanf(line, "f %u", &op.slot) == 1) {
+			op.alloc = false;
+			op.order = 0;
+		} else {
+			fprintf(stderr, "%s:%u: invalid trace operation\n", filename, lineno);
+			ok = false;
+			break;
+		}
+
+		nr_slots = std::max(nr_slots, op.slot + 1);
+		ops.push_back(op);
+	}
+
+	if (f != stdin) fclose(f);
+	return ok;
+}
+
+/**
+ * Writes a randomised trace to standard output.
+ */
+static void generate_trace(unsigned int nr_ops, uint64_t seed)
+{
+	std::vector<unsigned int> live;
+	unsigned int next_slot = 0;
+
+	printf("# host-bench trace: ops=%u seed=%#lx\n", nr_ops, seed);
+
+	for (unsigned int i = 0; i < nr_ops; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+
+		if (live.empty() || (live.size() < GEN_MAX_LIVE && (seed & 1))) {
+			int order = __builtin_ctzll((seed >> 1) | (1ull << GEN_MAX_ORDER));
+
+			printf("a %u %d\n", next_slot, order);
+			live.push_back(next_slot++);
+		} else {
+			unsigned int victim = (seed >> 1) % live.size();
+
+			printf("f %u\n", live[victim]);
+			live[victim] = live.back();
+			live.pop_back();
+		}
+	}
+
+	for (unsigned int slot : live) {
+		printf("f %u\n", slot);
+	}
+}
+
+static void report_latency(const char *alg, const char *op, std::vector<uint64_t>& cycles, uint64_t nr_failed)
+{
+	uint64_t total = 0;
+	for (uint64_t c : cycles) total += c;
+
+	std::sort(cycles.begin(), cycles.end());
+
+	size_t n = cycles.size();
+	printf("PGBENCH alg=%s api=host op=%s n=%zu failed=%lu mean=%lu p50=%lu p99=%lu max=%lu\n",
+		alg, op, n, nr_failed, n ? total / n : 0,
+		n ? cycles[(n - 1) / 2] : 0, n ? cycles[(n * 99 + 99) / 100 - 1] : 0, n ? cycles[n - 1] : 0);
+}
+
+/**
+ * Replays a trace against an algorithm, and reports the cost of each kind of operation.
+ * @return Returns false if the algorithm misbehaved.
+ */
+static bool replay_trace(const char *alg, unsigned long nr_pages, const std::vector<TraceOp>& ops, unsigned int nr_slots, unsigned int nr_repeats)
+{
+	if (hb_init(alg, nr_pages) != 0) {
+		fprintf(stderr, "unable to initialise algorithm '%s'\n", alg);
+		return false;
+	}
+
+	unsigned long initial_free = hb_count_free();
+
+	std::vector<Allocation> slots(nr_slots);
+	std::vector<uint64_t> alloc_cycles, free_cycles;
+	uint64_t nr_failed = 0, total_cycles = 0, total_ns = 0;
+
+	alloc_cycles.reserve(ops.size() * nr_repeats);
+	free_cycles.reserve(ops.size() * nr_repeats);
+
+	for (unsigned int repeat = 0; repeat < nr_repeats; repeat++) {
+		for (Allocation& a : slots) a.pfn = -1;
+
+		uint64_t start_ns = now_ns();
+
+		for (const TraceOp& op : ops) {
+			Allocation& a = slots[op.slot];
+
+			if (op.alloc) {
+				if (a.pfn >= 0) {
+					fprintf(stderr, "trace allocates into slot %u, which is in use\n", op.slot);
+					return false;
+				}
+
+				uint64_t start = rdtsc();
+				a.pfn = hb_alloc(op.order);
+				uint64_t cycles = rdtsc() - start;
+
+				a.order = op.order;
+				total_cycles += cycles;
+
+				if (a.pfn < 0) {
+					nr_failed++;
+				} else {
+					alloc_cycles.push_back(cycles);
+				}
+			} else {
+				// The allocation may have failed, in which case there is nothing to free.
+				if (a.pfn < 0) continue;
+
+				uint64_t start = rdtsc();
+				hb_free(a.pfn, a.order);
+				uint64_t cycles = rdtsc() - start;
+
+				a.pfn = -1;
+				total_cycles += cycles;
+				free_cycles.push_back(cycles);
+			}
+		}
+
+		total_ns += now_ns() - start_ns;
+
+		// Clean up after traces that leave allocations live, so that every repeat starts
+		// from the same state.
+		for (Allocation& a : slots) {
+			if (a.pfn >= 0) hb_free(a.pfn, a.order);
+		}
+	}
+
+	unsigned long final_free = hb_count_free();
+	if (final_free != initial_free) {
+		fprintf(stderr, "algorithm '%s' leaked pages: %lu free before, %lu after\n", alg, initial_free, final_free);
+		return false;
+	}
+
+	size_t nr_ops = alloc_cycles.size() + free_cycles.size() + nr_failed;
+
+	report_latency(alg, "alloc", alloc_cycles, nr_failed);
+	report_latency(alg, "free", free_cycles, 0);
+
+	printf("PGBENCH alg=%s api=host op=all n=%zu cycles=%lu ns=%lu ops_per_mcycle=%lu ops_per_sec=%lu\n",
+		alg, nr_ops, total_cycles, total_ns, total_cycles ? (nr_ops * 1000000ul) / total_cycles : 0,
+		total_ns ? (nr_ops * 1000000000ul) / total_ns : 0);
+
+	return true;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"usage: %s [-a algorithm] [-p pages] [-r repeats] [-v] trace-file\n"
+		"       %s -g nr-ops [-s seed]\n"
+		"       %s -l\n"
+		"\n"
+		"  -a  replay against the named algorithm only (default: all of them)\n"
+		"  -p  the number of pages of memory to manage (default: %lu)\n"
+		"  -r  the number of times to replay the trace (default: 1)\n"
+		"  -v  show debug messages from the algorithms\n"
+		"  -g  write a randomised trace of the given length to standard output\n"
+		"  -s  the seed for the generated trace\n"
+		"  -l  list the available algorithms\n",
+		argv0, argv0, argv0, DEFAULT_NR_PAGES);
+}
+
+int main(int argc, char **argv)
+{
+	const char *alg = NULL;
+	unsigned long nr_pages = DEFAULT_NR_PAGES;
+	unsigned int nr_repeats = 1, nr_generate = 0;
+	uint64_t seed = GEN_DEFAULT_SEED;
+	bool list = false;
+
+	int c;
+	while ((c = getopt(argc, argv, "a:p:r:vg:s:l")) != -1) {
+		switch (c) {
+		case 'a': alg = optarg; break;
+		case 'p': nr_pages = strtoul(optarg, NULL, 0); break;
+		case 'r': nr_repeats = strtoul(optarg, NULL, 0); break;
+		case 'v': hb_set_verbose(1); break;
+		case 'g': nr_generate = strtoul(optarg, NULL, 0); break;
+		case 's': seed = strtoull(optarg, NULL, 0); break;
+		case 'l': list = true; break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (list) {
+		for (unsigned int i = 0; hb_algorithm_name(i); i++) {
+			printf("%s\n", hb_algorithm_name(i));
+		}
+
+		return 0;
+	}
+
+	if (nr_generate) {
+		// A zero seed would make xorshift produce nothing but zeroes.
+		generate_trace(nr_generate, seed ? seed : GEN_DEFAULT_SEED);
+		return 0;
+	}
+
+	if (optind != argc - 1 || nr_pages < 2 || nr_repeats == 0) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	std::vector<TraceOp> ops;
+	unsigned int nr_slots;
+	if (!read_trace(argv[optind], ops, nr_slots)) return 1;
+
+	bool ok = true;
+	if (alg) {
+		ok = replay_trace(alg, nr_pages, ops, nr_slots, nr_repeats);
+	} else {
+		for (unsigned int i = 0; hb_algorithm_name(i); i++) {
+			ok &= replay_trace(hb_algorithm_name(i), nr_pages, ops, nr_slots, nr_repeats);
+		}
+	}
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * tools/host-bench/host-bench.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+// The interface between the benchmark driver, which is built against the host's headers,
+// and the shim that hosts the page allocation algorithms, which is built against the
+// kernel's headers.  Only plain C types may cross it.
+extern "C"
+{
+	const char *hb_algorithm_name(unsigned int index);
+	int hb_init(const char *algorithm, unsigned long nr_pages);
+
+	long hb_alloc(int order);
+	void hb_free(unsigned long pfn, int order);
+
+	unsigned long hb_count_free();
+	void hb_dump_state();
+	void hb_set_verbose(int verbose);
+}
@@ -0,0 +1,34 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * tools/host-bench/include/infos/kernel/kernel.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/kernel/log.h>
+#include <infos/mm/mm.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		/**
+		 * Stands in for the kernel in the host build.  Only the memory manager is provided.
+		 */
+		class Kernel
+		{
+		public:
+			mm::MemoryManager& mm() { return _mm; }
+
+		private:
+			mm::MemoryManager _mm;
+		};
+
+		extern Kernel sys;
+	}
+}
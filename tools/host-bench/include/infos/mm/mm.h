@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * tools/host-bench/include/infos/mm/mm.h
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#pragma once
+
+#include <infos/mm/page-allocator.h>
+
+namespace infos
+{
+	namespace kernel
+	{
+		class ComponentLog;
+	}
+
+	namespace mm
+	{
+		/**
+		 * Stands in for the kernel's memory manager in the host build.  It owns the page
+		 * allocator, and sets up its page descriptor array directly.
+		 */
+		class MemoryManager
+		{
+		public:
+			MemoryManager();
+
+			bool init(uint64_t nr_pages);
+			uint64_t nr_free_pages() const;
+
+			PageAllocator& pgalloc() { return _page_alloc; }
+
+		private:
+			PageAllocator _page_alloc;
+		};
+
+		extern kernel::ComponentLog mm_log;
+	}
+}
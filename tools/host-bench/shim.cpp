@@ -0,0 +1,228 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * tools/host-bench/shim.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/mm/page-allocator.h>
+#include <infos/mm/mm.h>
+#include <infos/kernel/kernel.h>
+#include <infos/kernel/log.h>
+
+#include "host-bench.h"
+
+using namespace infos::mm;
+using namespace infos::kernel;
+
+// The parts of the host C library that are needed.  Its headers cannot be included, as
+// they clash with the kernel's definitions.
+extern "C"
+{
+	int printf(const char *format, ...);
+	int snprintf(char *buffer, size_t size, const char *format, ...);
+	int vsnprintf(char *buffer, size_t size, const char *format, va_list args);
+	int strcmp(const char *l, const char *r);
+	void *calloc(size_t nmemb, size_t size);
+	void free(void *ptr);
+	void abort() __noreturn;
+}
+
+// The bounds of the algorithm registration section, provided by the host linker.
+extern PageAllocatorAlgorithm *__start_pgallocptr[], *__stop_pgallocptr[];
+
+static bool verbose;
+
+/**
+ * Writes log messages to standard output.  Debug messages are only shown in verbose mode.
+ */
+class HostLog : public Log
+{
+public:
+	void message(LogLevel::LogLevel level, const char *message) override
+	{
+		if (level == LogLevel::DEBUG && !verbose) return;
+
+		printf("%s\n", message);
+	}
+};
+
+static HostLog host_log;
+
+ComponentLog infos::mm::mm_log(host_log, "mm");
+ComponentLog infos::mm::pgalloc_log(host_log, "pgalloc");
+
+Kernel infos::kernel::sys;
+
+void __assertion_failure(const char *filename, int lineno, const char *expression)
+{
+	printf("assertion failed: %s:%d: %s\n", filename, lineno, expression);
+	abort();
+}
+
+void Log::messagef(LogLevel::LogLevel level, const char *format, ...)
+{
+	if (!enabled()) return;
+
+	char buffer[0x200];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	message(level, buffer);
+}
+
+ComponentLog::ComponentLog(Log& parent, const char *component_name) : _parent(parent), _component_name(component_name)
+{
+}
+
+void ComponentLog::message(LogLevel::LogLevel level, const char *message)
+{
+	if (!enabled()) return;
+
+	char message_buffer[0x200];
+	snprintf(message_buffer, sizeof(message_buffer), "%s: %s", _component_name, message);
+
+	_parent.message(level, message_buffer);
+}
+
+// The host build is single-threaded, so locks need do nothing.
+void infos::util::Mutex::lock()
+{
+}
+
+void infos::util::Mutex::unlock()
+{
+}
+
+PageAllocator::PageAllocator(MemoryManager& mm)
+	: Allocator(mm),
+	  _nr_pages(0),
+	  _page_descriptors(NULL),
+	  _allocator_algorithm(NULL)
+{
+}
+
+bool PageAllocator::init()
+{
+	return true;
+}
+
+MemoryManager::MemoryManager() : _page_alloc(*this)
+{
+}
+
+/**
+ * Creates a fresh page descriptor array, with every page available except page zero,
+ * and hands it to the selected allocation algorithm.
+ */
+bool MemoryManager::init(uint64_t nr_pages)
+{
+	PageAllocatorAlgorithm *alg = _page_alloc._allocator_algorithm;
+
+	free(_page_alloc._page_descriptors);
+
+	_page_alloc._nr_pages = nr_pages;
+	_page_alloc._page_descriptors = (PageDescriptor *)calloc(nr_pages, sizeof(PageDescriptor));
+	if (!_page_alloc._page_descriptors) return false;
+
+	if (!alg->init(_page_alloc._page_descriptors, nr_pages)) return false;
+
+	for (uint64_t pfn = 1; pfn < nr_pages; pfn++) {
+		_page_alloc._page_descriptors[pfn].type = PageDescriptorType::AVAILABLE;
+	}
+
+	_page_alloc._page_descriptors[0].type = PageDescriptorType::RESERVED;
+	alg->insert_page_range(&_page_alloc._page_descriptors[1], nr_pages - 1);
+
+	return true;
+}
+
+/**
+ * Counts the pages that are marked as available.
+ */
+uint64_t MemoryManager::nr_free_pages() const
+{
+	uint64_t nr_free = 0;
+	for (pfn_t pfn = 0; pfn < _page_alloc._nr_pages; pfn++) {
+		if (_page_alloc._page_descriptors[pfn].type == PageDescriptorType::AVAILABLE) {
+			nr_free++;
+		}
+	}
+
+	return nr_free;
+}
+
+const char *hb_algorithm_name(unsigned int index)
+{
+	if (__start_pgallocptr + index >= __stop_pgallocptr) return NULL;
+
+	return __start_pgallocptr[index]->name();
+}
+
+int hb_init(const char *algorithm, unsigned long nr_pages)
+{
+	PageAllocatorAlgorithm *candidate = NULL;
+	for (PageAllocatorAlgorithm **alg = __start_pgallocptr; alg < __stop_pgallocptr; alg++) {
+		if (strcmp((*alg)->name(), algorithm) == 0) {
+			candidate = *alg;
+		}
+	}
+
+	if (!candidate) return -1;
+
+	sys.mm().pgalloc().algorithm(*candidate);
+	return sys.mm().init(nr_pages) ? 0 : -1;
+}
+
+/**
+ * Allocates pages in the same way as the kernel's page allocator does with its lock held,
+ * i.e. without going through the per-CPU caches.
+ */
+long hb_alloc(int order)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	PageDescriptor *pgd = pgalloc.algorithm()->allocate_pages(order);
+	if (!pgd) return -1;
+
+	for (unsigned int i = 0; i < (1u << order); i++) {
+		assert(pgd[i].type == PageDescriptorType::AVAILABLE);
+		pgd[i].type = PageDescriptorType::ALLOCATED;
+	}
+
+	return pgalloc.pgd_to_pfn(pgd);
+}
+
+void hb_free(unsigned long pfn, int order)
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+	PageDescriptor *pgd = pgalloc.pfn_to_pgd(pfn);
+
+	pgalloc.algorithm()->free_pages(pgd, order);
+
+	for (unsigned int i = 0; i < (1u << order); i++) {
+		assert(pgd[i].type == PageDescriptorType::ALLOCATED);
+		pgd[i].type = PageDescriptorType::AVAILABLE;
+	}
+}
+
+unsigned long hb_count_free()
+{
+	return sys.mm().nr_free_pages();
+}
+
+void hb_dump_state()
+{
+	sys.mm().pgalloc().algorithm()->dump_state();
+}
+
+void hb_set_verbose(int v)
+{
+	verbose = !!v;
+}
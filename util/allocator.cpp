@@ -0,0 +1,26 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * util/allocator.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/util/allocator.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/object-allocator.h>
+
+using namespace infos::util;
+
+void *DefaultAllocator::alloc(size_t size)
+{
+	return infos::kernel::sys.mm().objalloc().alloc(size);
+}
+
+void DefaultAllocator::free(void *ptr)
+{
+	infos::kernel::sys.mm().objalloc().free(ptr);
+}
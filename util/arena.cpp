@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * util/arena.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/util/arena.h>
+#include <infos/kernel/kernel.h>
+#include <infos/mm/mm.h>
+#include <infos/mm/page-allocator.h>
+
+using namespace infos::util;
+using namespace infos::mm;
+using namespace infos::kernel;
+
+// Each chunk taken for the arena is twice the size of the last, up to this many pages, so
+// that small arenas stay small, and large arenas do not go back to the page allocator too
+// often.
+#define ARENA_MAX_CHUNK_PAGES	16
+
+/**
+ * Takes a new chunk of pages for the arena, and allocates from it.  Any space left over in
+ * the current chunk is abandoned.
+ * @return Returns the allocated memory, or NULL if the page allocator is out of memory.
+ */
+void *Arena::alloc_slow(size_t size, size_t align)
+{
+	size_t header_size = (sizeof(Chunk) + align - 1) & ~(align - 1);
+	uint64_t nr_pages = __max(_chunk_pages, (header_size + size + __page_size - 1) >> __page_bits);
+
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	PageDescriptor *pgd = pgalloc.alloc_page_run(nr_pages);
+	if (!pgd) {
+		return NULL;
+	}
+
+	Chunk *chunk = (Chunk *)pgalloc.pgd_to_vpa(pgd);
+	chunk->next = _chunks;
+	chunk->nr_pages = nr_pages;
+
+	_chunks = chunk;
+	_nr_pages += nr_pages;
+	_chunk_pages = __min(_chunk_pages * 2, (uint64_t)ARENA_MAX_CHUNK_PAGES);
+
+	uintptr_t ptr = (uintptr_t)chunk + header_size;
+
+	_next = ptr + size;
+	_end = (uintptr_t)chunk + (nr_pages << __page_bits);
+
+	return (void *)ptr;
+}
+
+/**
+ * Gives every page held by the arena back to the page allocator, invalidating everything
+ * that was allocated from it.  The arena can be used again afterwards.
+ */
+void Arena::release()
+{
+	PageAllocator& pgalloc = sys.mm().pgalloc();
+
+	while (_chunks) {
+		Chunk *chunk = _chunks;
+		_chunks = chunk->next;
+
+		pgalloc.free_page_run(pgalloc.vpa_to_pgd((virt_addr_t)chunk), chunk->nr_pages);
+	}
+
+	_next = 0;
+	_end = 0;
+	_chunk_pages = 1;
+	_nr_pages = 0;
+}
@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: MIT */
+
+/*
+ * util/intrusive-rbtree.cpp
+ *
+ * InfOS
+ * Copyright (C) University of Edinburgh 2016.  All Rights Reserved.
+ *
+ * Tom Spink <tspink@inf.ed.ac.uk>
+ */
+#include <infos/util/intrusive-rbtree.h>
+
+using namespace infos::util;
+
+static inline bool is_red(IntrusiveRBLink *node)
+{
+	return node && node->red;
+}
+
+/**
+ * Links a node into the tree as a child of the given parent, and rebalances the tree.
+ * @param node The node to link
+ * @param parent The node's parent, or NULL if the tree is empty
+ * @param left True if the node becomes its parent's left child
+ */
+void IntrusiveRBTreeBase::link(IntrusiveRBLink *node, IntrusiveRBLink *parent, bool left)
+{
+	node->parent = parent;
+	node->left = node->right = NULL;
+	node->red = true;
+
+	if (!parent) {
+		_root = node;
+		_leftmost = node;
+	} else if (left) {
+		parent->left = node;
+
+		if (parent == _leftmost) {
+			_leftmost = node;
+		}
+	} else {
+		parent->right = node;
+	}
+
+	_count++;
+
+	propagate(node);
+	insert_fixup(node);
+}
+
+/**
+ * Removes a node from the tree, and rebalances the tree.
+ */
+void IntrusiveRBTreeBase::erase(IntrusiveRBLink *node)
+{
+	if (node == _leftmost) {
+		_leftmost = next(node);
+	}
+
+	// The node that is actually taken out of its position: either the node itself, or its
+	// successor if it has two children.  The child that takes its place may be NULL, so its
+	// parent is tracked separately.
+	IntrusiveRBLink *child, *parent;
+	bool removed_red = node->red;
+
+	if (!node->left) {
+		child = node->right;
+		parent = node->parent;
+		replace(node, child);
+	} else if (!node->right) {
+		child = node->left;
+		parent = node->parent;
+		replace(node, child);
+	} else {
+		IntrusiveRBLink *successor = node->right;
+		while (successor->left) {
+			successor = successor->left;
+		}
+
+		removed_red = successor->red;
+		child = successor->right;
+
+		if (successor->parent == node) {
+			parent = successor;
+		} else {
+			parent = successor->parent;
+			replace(successor, successor->right);
+
+			successor->right = node->right;
+			successor->right->parent = successor;
+		}
+
+		replace(node, successor);
+		successor->left = node->left;
+		successor->left->parent = successor;
+		successor->red = node->red;
+	}
+
+	// Every node whose subtree changed is on the path up from the removed position.
+	propagate(parent);
+
+	if (!removed_red) {
+		erase_fixup(child, parent);
+	}
+
+	node->parent = node;
+	node->left = node->right = NULL;
+
+	_count--;
+}
+
+/**
+ * Returns the in-order successor of a node, or NULL if it is the last node in its tree.
+ */
+IntrusiveRBLink *IntrusiveRBTreeBase::next(IntrusiveRBLink *node)
+{
+	if (node->right) {
+		node = node->right;
+		while (node->left) {
+			node = node->left;
+		}
+
+		return node;
+	}
+
+	while (node->parent && node == node->parent->right) {
+		node = node->parent;
+	}
+
+	return node->parent;
+}
+
+/**
+ * Recomputes the augmented data of a node and all of its ancestors.
+ */
+void IntrusiveRBTreeBase::propagate(IntrusiveRBLink *node)
+{
+	if (!_augment) return;
+
+	for (; node; node = node->parent) {
+		_augment(node);
+	}
+}
+
+void IntrusiveRBTreeBase::rotate_left(IntrusiveRBLink *node)
+{
+	IntrusiveRBLink *pivot = node->right;
+
+	node->right = pivot->left;
+	if (pivot->left) {
+		pivot->left->parent = node;
+	}
+
+	replace(node, pivot);
+
+	pivot->left = node;
+	node->parent = pivot;
+
+	// The node is now below the pivot, so it is brought up to date first.
+	if (_augment) {
+		_augment(node);
+		_augment(pivot);
+	}
+}
+
+void IntrusiveRBTreeBase::rotate_right(IntrusiveRBLink *node)
+{
+	IntrusiveRBLink *pivot = node->left;
+
+	node->left = pivot->right;
+	if (pivot->right) {
+		pivot->right->parent = node;
+	}
+
+	replace(node, pivot);
+
+	pivot->right = node;
+	node->parent = pivot;
+
+	if (_augment) {
+		_augment(node);
+		_augment(pivot);
+	}
+}
+
+/**
+ * Puts a replacement (which may be NULL) in a node's position under its parent.
+ */
+void IntrusiveRBTreeBase::replace(IntrusiveRBLink *node, IntrusiveRBLink *replacement)
+{
+	IntrusiveRBLink *parent = node->parent;
+
+	if (!parent) {
+		_root = replacement;
+	} else if (node == parent->left) {
+		parent->left = replacement;
+	} else {
+		parent->right = replacement;
+	}
+
+	if (replacement) {
+		replacement->parent = parent;
+	}
+}
+
+void IntrusiveRBTreeBase::insert_fixup(IntrusiveRBLink *node)
+{
+	while (is_red(node->parent)) {
+		IntrusiveRBLink *parent = node->parent;
+		IntrusiveRBLink *grandparent = parent->parent;
+
+		if (parent == grandparent->left) {
+			IntrusiveRBLink *uncle = grandparent->right;
+
+			if (is_red(uncle)) {
+				parent->red = false;
+				uncle->red = false;
+				grandparent->red = true;
+				node = grandparent;
+				continue;
+			}
+
+			if (node == parent->right) {
+				rotate_left(parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->red = false;
+			grandparent->red = true;
+			rotate_right(grandparent);
+		} else {
+			IntrusiveRBLink *uncle = grandparent->left;
+
+			if (is_red(uncle)) {
+				parent->red = false;
+				uncle->red = false;
+				grandparent->red = true;
+				node = grandparent;
+				continue;
+			}
+
+			if (node == parent->left) {
+				rotate_right(parent);
+				node = parent;
+				parent = node->parent;
+			}
+
+			parent->red = false;
+			grandparent->red = true;
+			rotate_left(grandparent);
+		}
+	}
+
+	_root->red = false;
+}
+
+void IntrusiveRBTreeBase::erase_fixup(IntrusiveRBLink *node, IntrusiveRBLink *parent)
+{
+	while (node != _root && !is_red(node)) {
+		if (node == parent->left) {
+			IntrusiveRBLink *sibling = parent->right;
+
+			if (sibling->red) {
+				sibling->red = false;
+				parent->red = true;
+				rotate_left(parent);
+				sibling = parent->right;
+			}
+
+			if (!is_red(sibling->left) && !is_red(sibling->right)) {
+				sibling->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if (!is_red(sibling->right)) {
+				sibling->left->red = false;
+				sibling->red = true;
+				rotate_right(sibling);
+				sibling = parent->right;
+			}
+
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->right->red = false;
+			rotate_left(parent);
+		} else {
+			IntrusiveRBLink *sibling = parent->left;
+
+			if (sibling->red) {
+				sibling->red = false;
+				parent->red = true;
+				rotate_right(parent);
+				sibling = parent->left;
+			}
+
+			if (!is_red(sibling->left) && !is_red(sibling->right)) {
+				sibling->red = true;
+				node = parent;
+				parent = node->parent;
+				continue;
+			}
+
+			if (!is_red(sibling->left)) {
+				sibling->right->red = false;
+				sibling->red = true;
+				rotate_left(sibling);
+				sibling = parent->left;
+			}
+
+			sibling->red = parent->red;
+			parent->red = false;
+			sibling->left->red = false;
+			rotate_right(parent);
+		}
+
+		node = _root;
+	}
+
+	if (node) {
+		node->red = false;
+	}
+}
@@ -27,6 +27,20 @@ void Mutex::lock()
 	_owner = &Thread::current();
 }
 
+/**
+ * Acquires the mutex if it is free, without waiting for it.
+ * @return Returns true if the mutex was acquired.
+ */
+bool Mutex::try_lock()
+{
+	if (__sync_lock_test_and_set(&_locked, 1)) {
+		return false;
+	}
+	
+	_owner = &Thread::current();
+	return true;
+}
+
 void Mutex::unlock()
 {
 	__sync_lock_release(&_locked);
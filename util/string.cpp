@@ -50,6 +50,54 @@ char *infos::util::strncpy(char *dest, const char *src, size_t n)
 	return dest;
 }
 
+/**
+ * Converts the initial part of a string into an unsigned integer.
+ * @param str The string to convert.
+ * @param end If non-NULL, receives a pointer to the first unconverted character.
+ * @param base The base of the number, or zero to detect a "0x" (hex) or "0" (octal) prefix.
+ * @return Returns the converted value.
+ */
+unsigned long infos::util::strtoul(const char *str, const char **end, int base)
+{
+	while (*str == ' ') str++;
+
+	if (base == 0) {
+		if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+			base = 16;
+			str += 2;
+		} else if (str[0] == '0' && str[1] != 0) {
+			base = 8;
+			str++;
+		} else {
+			base = 10;
+		}
+	} else if (base == 16 && str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+		str += 2;
+	}
+
+	unsigned long value = 0;
+	for (;;) {
+		int digit;
+		if (*str >= '0' && *str <= '9') {
+			digit = *str - '0';
+		} else if (*str >= 'a' && *str <= 'z') {
+			digit = *str - 'a' + 10;
+		} else if (*str >= 'A' && *str <= 'Z') {
+			digit = *str - 'A' + 10;
+		} else {
+			break;
+		}
+
+		if (digit >= base) break;
+
+		value = (value * base) + digit;
+		str++;
+	}
+
+	if (end) *end = str;
+	return value;
+}
+
 String infos::util::ToString(unsigned int v)
 {
 #define BUFFER_SIZE	16
@@ -20,12 +20,12 @@ using namespace infos::util;
 
 void *operator new(size_t size)
 {
-	return sys.mm().objalloc().alloc(size, AllocFlags::NONE);
+	return sys.mm().objalloc().alloc(size, AllocFlags::NONE, __builtin_return_address(0));
 }
 
 void *operator new[](size_t size)
 {
-	return sys.mm().objalloc().alloc(size, AllocFlags::NONE);
+	return sys.mm().objalloc().alloc(size, AllocFlags::NONE, __builtin_return_address(0));
 }
 
 void operator delete(void *p)
@@ -34,10 +34,50 @@ void operator delete(void *p)
 }
 
 void operator delete(void *p, size_t sz)
+{
+	sys.mm().objalloc().free(p, sz);
+}
+
+void operator delete[](void *p)
+{
+	sys.mm().objalloc().free(p);
+}
+
+void operator delete[](void *p, size_t sz)
+{
+	sys.mm().objalloc().free(p, sz);
+}
+
+void *operator new(size_t size, std::align_val_t align)
+{
+	return sys.mm().objalloc().alloc_aligned(size, (size_t)align, AllocFlags::NONE, __builtin_return_address(0));
+}
+
+void *operator new[](size_t size, std::align_val_t align)
+{
+	return sys.mm().objalloc().alloc_aligned(size, (size_t)align, AllocFlags::NONE, __builtin_return_address(0));
+}
+
+void operator delete(void *p, std::align_val_t align)
 {
 	sys.mm().objalloc().free(p);
 }
 
+void operator delete(void *p, size_t sz, std::align_val_t align)
+{
+	sys.mm().objalloc().free(p, sz);
+}
+
+void operator delete[](void *p, std::align_val_t align)
+{
+	sys.mm().objalloc().free(p);
+}
+
+void operator delete[](void *p, size_t sz, std::align_val_t align)
+{
+	sys.mm().objalloc().free(p, sz);
+}
+
 extern "C" {
 
 	void __cxa_pure_virtual()
@@ -11,6 +11,7 @@
 #include <infos/util/event.h>
 #include <infos/kernel/kernel.h>
 #include <infos/kernel/thread.h>
+#include <infos/util/lock.h>
 #include <arch/arch.h>
 
 using namespace infos::kernel;
@@ -18,17 +19,21 @@ using namespace infos::util;
 
 void WakeQueue::sleep(Thread& thread)
 {
-    // TODO: some sort of lock
-    _waiters.append(&thread);
+    // Interrupts stay disabled until the thread is asleep, so that it cannot be woken (and
+    // taken off the queue) while it is still running, which would leave it asleep for good.
+    UniqueIRQLock l;
+
+    _waiters.append(thread);
     thread.sleep();
 }
 
 void WakeQueue::wake()
 {
-    // TODO: some sort of lock
-    for (auto waiter : _waiters) {
+    UniqueIRQLock l;
+
+    // Each waiter is taken off the queue before it is woken, so that it is free to sleep on
+    // another queue straight away.
+    while (Thread *waiter = _waiters.pop_front()) {
         waiter->wake_up();
     }
-
-    _waiters.clear();
 }